@@ -0,0 +1,54 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+namespace bench{
+    // Keeps the optimizer from discarding a result
+    template<typename T>
+    inline void keep(const T& value){
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    // Repeats f for roughly 200ms and reports the time per call, and throughput when bytes_per_call is given
+    template<typename F>
+    void run(std::string_view name, F&& f, std::size_t bytes_per_call = 0){
+        using clock = std::chrono::steady_clock;
+        std::size_t iterations = 0;
+        std::size_t batch = 1;
+        auto start = clock::now();
+        auto elapsed = clock::duration{};
+        while(elapsed < std::chrono::milliseconds(200)){
+            for(std::size_t i = 0; i < batch; i++)
+                f();
+            iterations += batch;
+            batch *= 2;
+            elapsed = clock::now() - start;
+        }
+        auto ns = std::chrono::duration<double, std::nano>(elapsed).count() / static_cast<double>(iterations);
+        if(bytes_per_call > 0)
+            std::printf("%-48s %10.1f ns/op %8.2f GB/s\n", std::string{name}.c_str(), ns, static_cast<double>(bytes_per_call) / ns);
+        else
+            std::printf("%-48s %10.1f ns/op\n", std::string{name}.c_str(), ns);
+    }
+
+    void router_benchmarks();
+    void parser_benchmarks();
+    void json_benchmarks();
+    void response_benchmarks();
+
+    struct LoadOptions{
+        std::size_t connections{64};
+        std::size_t pipeline{1}; // Requests written back to back before reading the responses
+        std::size_t payload{64}; // Response body bytes
+        bool keep_alive{true};
+        uint32_t server_threads{2};
+        uint32_t client_threads{2};
+        bool sharded{false};
+        std::chrono::seconds duration{5};
+    };
+
+    void load_test(const LoadOptions& options);
+}
@@ -0,0 +1,142 @@
+#include "bench.h"
+#include <htpp/json.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace{
+    struct Time{
+        using json_names = json::key_name<"hour", "minute", "second">;
+        int hour{13};
+        int minute{37};
+        int second{42};
+    };
+
+    struct Message{
+        using json_names = json::key_name<"message">;
+        std::string message{"Hello, World!"};
+    };
+
+    struct User{
+        using json_names = json::key_name<"id", "name", "email">;
+        long long id;
+        std::string name;
+        std::string email;
+    };
+
+    struct UserView{
+        using json_names = json::key_name<"id", "name", "email">;
+        long long id;
+        std::string_view name;
+        std::string_view email;
+    };
+
+    // The stringstream serializer objects went through before the buffer writer, unrolled for up to three members
+    namespace legacy{
+        template<typename T>
+        void serialize(std::stringstream& s, const T& object);
+
+        template<typename T>
+        void serialize_field(std::stringstream& s, const T& field){
+            if constexpr(std::is_integral_v<T> || std::is_floating_point_v<T>)
+                s << field;
+            else if constexpr(std::is_convertible_v<T, std::string_view>)
+                s << '"' << std::string_view{field} << '"';
+            else
+                serialize(s, field);
+        }
+
+        template<typename T>
+        void serialize(std::stringstream& s, const T& object){
+            constexpr auto size = T::json_names::count();
+            s << '{';
+            if constexpr(size == 1){
+                const auto& [v1] = object;
+                s << '"' << T::json_names::template get<0>() << "\":"; serialize_field(s, v1);
+            }else if constexpr(size == 3){
+                const auto& [v1, v2, v3] = object;
+                s << '"' << T::json_names::template get<0>() << "\":"; serialize_field(s, v1); s << ',';
+                s << '"' << T::json_names::template get<1>() << "\":"; serialize_field(s, v2); s << ',';
+                s << '"' << T::json_names::template get<2>() << "\":"; serialize_field(s, v3);
+            }
+            s << '}';
+        }
+
+        template<std::ranges::range T> requires (!std::is_convertible_v<T, std::string_view>)
+        void serialize(std::stringstream& s, const T& range){
+            s << '[';
+            bool first = true;
+            for(const auto& item : range){
+                if(!first)
+                    s << ',';
+                first = false;
+                serialize_field(s, item);
+            }
+            s << ']';
+        }
+    }
+
+    template<typename T>
+    void compare(std::string_view name, const T& value){
+        htpp::ResponseBuffer buffer;
+        json::inner::serialize(buffer, value);
+        auto bytes = buffer.size();
+        bench::run(std::string{"json legacy, "} + std::string{name}, [&]{
+            std::stringstream s;
+            legacy::serialize(s, value);
+            bench::keep(s.str());
+        }, bytes);
+        bench::run(std::string{"json writer, "} + std::string{name}, [&]{
+            buffer.clear();
+            json::inner::serialize(buffer, value);
+            bench::keep(buffer);
+        }, bytes);
+    }
+}
+
+// Serializing into a reused response buffer against the stringstream serializer it replaced, and parsing
+void bench::json_benchmarks(){
+    compare("3 ints", Time{});
+    compare("short string", Message{});
+
+    std::vector<User> users;
+    for(long long i = 0; i < 100; i++)
+        users.push_back({i * 7919, "user number " + std::to_string(i), "user" + std::to_string(i) + "@example.com"});
+    compare("100 users", users);
+
+    Message long_text{std::string(4096, 'x')};
+    compare("4KB string", long_text);
+
+    // Only the writer escapes, so escape heavy text has no legacy counterpart
+    Message quoted{};
+    for(int i = 0; i < 256; i++)
+        quoted.message += "line \"" + std::to_string(i) + "\"\n";
+    htpp::ResponseBuffer buffer;
+    run("json writer, escape heavy string", [&]{
+        buffer.clear();
+        json::inner::serialize(buffer, quoted);
+        keep(buffer);
+    }, quoted.message.size());
+
+    // Parsing back what the writer produced, string members are views into the text
+    std::string users_text = [&]{
+        htpp::ResponseBuffer out;
+        json::inner::serialize(out, users);
+        return out.str();
+    }();
+    run("json parse, 3 ints", [&]{
+        keep(json::parse<Time>(R"({"hour":13,"minute":37,"second":42})"));
+    }, 36);
+    std::string storage;
+    run("json parse, 100 users", [&]{
+        keep(json::parse<std::vector<UserView>>(users_text, storage));
+    }, users_text.size());
+
+    // Members the struct doesn't have are skipped without being converted
+    std::string unknown_text = R"({"hour":1,"extra":{"tags":["a","b","c"],"nested":{"deep":[1,2,3,true,null]}},"notes":")"
+        + std::string(1024, 'n') + R"(","minute":2,"second":3})";
+    run("json parse, skipping unknown members", [&]{
+        keep(json::parse<Time>(unknown_text));
+    }, unknown_text.size());
+}
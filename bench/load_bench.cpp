@@ -0,0 +1,146 @@
+#include "bench.h"
+#include <htpp/lib.h>
+
+#include <algorithm>
+#include <asio.hpp>
+#include <charconv>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace{
+    using clock = std::chrono::steady_clock;
+
+    std::string payload_body;
+
+    struct Payload : htpp::OkResponse{
+        void print_content(htpp::ResponseBuffer& s) const { s.borrow(payload_body); }
+        htpp::ContentType content_type() const { return htpp::ContentType::TextPlain; }
+        std::size_t content_size() const { return payload_body.size(); }
+    };
+
+    asio::awaitable<void> handle_payload(htpp::Context& ctx, std::string_view){
+        return ctx.send(Payload{});
+    }
+
+    // A port nothing listens on right now, the server binds it a moment later
+    uint16_t free_port(){
+        asio::io_context io;
+        asio::ip::tcp::acceptor acceptor{io, {asio::ip::tcp::v4(), 0}};
+        return acceptor.local_endpoint().port();
+    }
+
+    struct ClientStats{
+        std::vector<uint64_t> latencies; // Nanoseconds from writing a batch to each of its responses
+        std::size_t errors{0};
+    };
+
+    // Reads one response off the front of buffer, throws once the server closes the connection
+    asio::awaitable<void> read_response(asio::ip::tcp::socket& socket, std::string& buffer){
+        auto head_end = co_await asio::async_read_until(socket, asio::dynamic_buffer(buffer), "\r\n\r\n", asio::use_awaitable);
+        std::size_t length = 0;
+        std::string_view head{buffer.data(), head_end};
+        if(auto at = head.find("Content-Length: "); at != std::string_view::npos)
+            std::from_chars(head.data() + at + 16, head.data() + head.size(), length);
+        if(buffer.size() < head_end + length)
+            co_await asio::async_read(socket, asio::dynamic_buffer(buffer), asio::transfer_exactly(head_end + length - buffer.size()), asio::use_awaitable);
+        buffer.erase(0, head_end + length);
+    }
+
+    asio::awaitable<void> client(asio::ip::tcp::endpoint server, const bench::LoadOptions& options, clock::time_point until, ClientStats& stats){
+        auto executor = co_await asio::this_coro::executor;
+        std::string request = options.keep_alive ? "GET /payload HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                                                 : "GET /payload HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+        std::string batch;
+        for(std::size_t i = 0; i < options.pipeline; i++)
+            batch += request;
+
+        asio::ip::tcp::socket socket{executor};
+        std::string buffer;
+        while(clock::now() < until){
+            try{
+                if(!socket.is_open()){
+                    buffer.clear();
+                    co_await socket.async_connect(server, asio::use_awaitable);
+                    socket.set_option(asio::ip::tcp::no_delay{true});
+                }
+                auto sent = clock::now();
+                co_await asio::async_write(socket, asio::buffer(batch), asio::use_awaitable);
+                for(std::size_t i = 0; i < options.pipeline; i++){
+                    co_await read_response(socket, buffer);
+                    stats.latencies.push_back(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - sent).count()));
+                }
+                if(!options.keep_alive)
+                    socket.close();
+            }
+            catch(std::exception&){
+                stats.errors++;
+                socket.close();
+            }
+        }
+    }
+
+    double percentile_micros(const std::vector<uint64_t>& sorted, double fraction){
+        if(sorted.empty())
+            return 0;
+        auto index = std::min(sorted.size() - 1, static_cast<std::size_t>(fraction * static_cast<double>(sorted.size())));
+        return static_cast<double>(sorted[index]) / 1000.0;
+    }
+}
+
+// Drives an in-process server over loopback and reports throughput and latency percentiles
+void bench::load_test(const LoadOptions& options){
+    payload_body.assign(options.payload, 'x');
+    auto port = free_port();
+
+    htpp::Server server{port};
+    server.set_threads(options.server_threads)
+          .set_thread_mode(options.sharded ? htpp::ThreadMode::Sharded : htpp::ThreadMode::Shared)
+          .set_routes({{htpp::RequestType::GET, "/payload", handle_payload}});
+    std::jthread server_thread{[&server]{ server.run(); }};
+
+    asio::ip::tcp::endpoint endpoint{asio::ip::address_v4::loopback(), port};
+    for(int attempt = 0;; attempt++){
+        asio::io_context probe_io;
+        asio::ip::tcp::socket probe{probe_io};
+        asio::error_code ec;
+        probe.connect(endpoint, ec);
+        if(!ec)
+            break;
+        if(attempt == 100){
+            std::printf("load: server did not start listening on port %u\n", port);
+            server.stop();
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+
+    asio::io_context io{static_cast<int>(options.client_threads)};
+    std::vector<ClientStats> stats(options.connections);
+    auto start = clock::now();
+    auto until = start + options.duration;
+    for(auto& connection : stats){
+        auto strand = asio::make_strand(io);
+        asio::co_spawn(strand, client(endpoint, options, until, connection), asio::detached);
+    }
+    std::vector<std::jthread> threads;
+    for(uint32_t i = 0; i < options.client_threads; i++)
+        threads.emplace_back([&io]{ io.run(); });
+    threads.clear();
+    auto elapsed = std::chrono::duration<double>(clock::now() - start).count();
+
+    std::vector<uint64_t> latencies;
+    std::size_t errors = 0;
+    for(const auto& connection : stats){
+        latencies.insert(latencies.end(), connection.latencies.begin(), connection.latencies.end());
+        errors += connection.errors;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    std::printf("load: %zu connections, pipeline %zu, %zu byte bodies, keep-alive %s, %u server threads%s\n",
+        options.connections, options.pipeline, options.payload, options.keep_alive ? "on" : "off", options.server_threads, options.sharded ? " sharded" : "");
+    std::printf("load: %.0f req/s, p50 %.1f us, p99 %.1f us, p999 %.1f us, %zu errors\n",
+        static_cast<double>(latencies.size()) / elapsed, percentile_micros(latencies, 0.5), percentile_micros(latencies, 0.99),
+        percentile_micros(latencies, 0.999), errors);
+    server.stop();
+}
@@ -0,0 +1,68 @@
+#include "bench.h"
+
+#include <charconv>
+#include <cstdio>
+#include <string_view>
+
+namespace{
+    void usage(){
+        std::puts("usage: htpp_bench [micro|load] [--connections N] [--pipeline N] [--payload BYTES] [--no-keep-alive]\n"
+                  "                  [--server-threads N] [--client-threads N] [--sharded] [--seconds N]");
+    }
+
+    template<typename T>
+    bool parse_number(std::string_view text, T& out){
+        auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), out);
+        return ec == std::errc{} && end == text.data() + text.size() && out > 0;
+    }
+}
+
+int main(int argc, char** argv){
+    bool micro = true;
+    bool load = true;
+    bench::LoadOptions options;
+    for(int i = 1; i < argc; i++){
+        std::string_view arg{argv[i]};
+        std::string_view value = i + 1 < argc ? argv[i + 1] : "";
+        bool ok = true;
+        if(arg == "micro")
+            load = false;
+        else if(arg == "load")
+            micro = false;
+        else if(arg == "--no-keep-alive")
+            options.keep_alive = false;
+        else if(arg == "--sharded")
+            options.sharded = true;
+        else if(arg == "--connections")
+            ok = parse_number(value, options.connections), i++;
+        else if(arg == "--pipeline")
+            ok = parse_number(value, options.pipeline), i++;
+        else if(arg == "--payload")
+            ok = parse_number(value, options.payload) || value == "0", i++;
+        else if(arg == "--server-threads")
+            ok = parse_number(value, options.server_threads), i++;
+        else if(arg == "--client-threads")
+            ok = parse_number(value, options.client_threads), i++;
+        else if(arg == "--seconds"){
+            long seconds = 0;
+            ok = parse_number(value, seconds), i++;
+            options.duration = std::chrono::seconds{seconds};
+        }else
+            ok = false;
+        if(!ok){
+            usage();
+            return 1;
+        }
+    }
+    if(!options.keep_alive)
+        options.pipeline = 1; // The server closes after the first response
+
+    if(micro){
+        bench::router_benchmarks();
+        bench::parser_benchmarks();
+        bench::json_benchmarks();
+        bench::response_benchmarks();
+    }
+    if(load)
+        bench::load_test(options);
+}
@@ -0,0 +1,105 @@
+#include "bench.h"
+#include "request_parser.h"
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+
+namespace{
+    constexpr std::string_view browser_headers{
+        "Host: localhost:8080\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+        "Accept-Language: en-US,en;q=0.5\r\n"
+        "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+        "Connection: keep-alive\r\n"
+        "Cookie: session=6f1c2a9e8b7d4c3f; theme=dark; tracking_consent=granted\r\n"
+        "Upgrade-Insecure-Requests: 1\r\n"
+        "Sec-Fetch-Dest: document\r\n"
+        "Sec-Fetch-Mode: navigate\r\n"
+        "Sec-Fetch-Site: none\r\n"
+        "Priority: u=0, i\r\n"
+        "\r\n"
+    };
+
+    constexpr std::string_view browser_request_line{
+        "GET /api/resource/42/orders?page=3&sort=created&filter=open HTTP/1.1\r\n"
+    };
+
+    constexpr std::string_view minimal_headers{
+        "Host: localhost\r\n"
+        "Accept: */*\r\n"
+        "\r\n"
+    };
+
+    // The line splitting parser headers went through before the tokenizer, it only looked for a few names
+    struct LegacyResult{
+        bool close{false};
+        std::string_view encoding;
+        std::string_view length;
+    };
+
+    bool legacy_iequals(std::string_view a, std::string_view b){
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char l, char r){
+            return (l | 0x20) == (r | 0x20);
+        });
+    }
+
+    LegacyResult legacy_parse(std::string_view headers){
+        LegacyResult result;
+        while(true){
+            auto line_end = headers.find("\r\n");
+            auto line = headers.substr(0, line_end);
+            headers.remove_prefix(line_end + 2);
+            if(line.empty())
+                return result;
+            auto colon = line.find(':');
+            auto key = line.substr(0, colon);
+            auto value = line.substr(colon + 1);
+            while(!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+                value.remove_prefix(1);
+            if(legacy_iequals(key, "Connection") && legacy_iequals(value, "close"))
+                result.close = true;
+            else if(legacy_iequals(key, "Accept-Encoding"))
+                result.encoding = value;
+            else if(legacy_iequals(key, "Content-Length"))
+                result.length = value;
+        }
+    }
+}
+
+// Request head parsing. The tokenizer records every header while the legacy loop only matched a few names.
+void bench::parser_benchmarks(){
+    htpp::Request request{};
+    std::string line{browser_request_line};
+    line += "\r\n"; // The parser relies on the head ending in a blank line
+    run("request line", [&]{
+        keep(htpp::parse_request_line(line, request));
+    }, browser_request_line.size());
+
+    std::string head = std::string{browser_request_line} + std::string{browser_headers};
+    run("request head, browser", [&]{
+        auto block = htpp::parse_request_line(head, request);
+        htpp::tokenize_headers({block, head.data() + head.size()}, request.headers);
+        keep(request);
+    }, head.size());
+
+    htpp::Headers headers;
+    for(auto [name, block] : {std::pair{"browser", browser_headers}, std::pair{"minimal", minimal_headers}}){
+        run(std::string{"headers legacy, "} + name, [&]{
+            keep(legacy_parse(block));
+        }, block.size());
+        run(std::string{"headers tokenizer, "} + name, [&]{
+            htpp::tokenize_headers(block, headers);
+            keep(headers.get(htpp::Header::AcceptEncoding));
+        }, block.size());
+    }
+
+    htpp::tokenize_headers(browser_headers, headers);
+    run("header lookup by id", [&]{
+        keep(headers.get(htpp::Header::Cookie));
+    });
+    run("header lookup by name", [&]{
+        keep(headers.get("sec-fetch-mode"));
+    });
+}
@@ -0,0 +1,71 @@
+#include "bench.h"
+#include <htpp/json.h>
+#include <htpp/response.h>
+
+#include <array>
+#include <string>
+#include <string_view>
+
+namespace{
+    // Builds responses into the buffer like a connection would, without a socket behind it
+    class BenchContext : public htpp::Context{
+        void default_headers() override {
+            response_buffer << "Server: htpp\r\nDate: Sat, 17 Oct 2026 12:00:00 GMT\r\n";
+        }
+        asio::awaitable<void> send_response() override { co_return; }
+        asio::awaitable<void> send_file(htpp::FileResponse) override { co_return; }
+        asio::awaitable<void> flush() override { co_return; }
+
+    public:
+        asio::awaitable<std::string_view> body() override { co_return std::string_view{}; }
+        asio::awaitable<std::string_view> read_body() override { co_return std::string_view{}; }
+
+        std::size_t built() const { return response_buffer.size(); }
+        void reset(){ response_buffer.clear(); }
+    };
+
+    struct Text : htpp::OkResponse{
+        std::string_view text;
+        void print_content(htpp::ResponseBuffer& s) const { s << text; }
+        htpp::ContentType content_type() const { return htpp::ContentType::TextPlain; }
+        std::size_t content_size() const { return text.size(); }
+    };
+
+    // Unknown size, so the length header is slotted in front of the body afterwards
+    struct UnsizedText : htpp::OkResponse{
+        std::string_view text;
+        void print_content(htpp::ResponseBuffer& s) const { s << text; }
+        htpp::ContentType content_type() const { return htpp::ContentType::TextPlain; }
+    };
+
+    struct Message{
+        using json_names = json::key_name<"message">;
+        std::string_view message;
+    };
+}
+
+// Head and body building in Context::send, and the content type lookup static files go through
+void bench::response_benchmarks(){
+    BenchContext ctx;
+    auto measure = [&](std::string_view name, const auto& response){
+        ctx.reset();
+        { auto ignored = ctx.send(response); }
+        auto bytes = ctx.built();
+        run(name, [&]{
+            ctx.reset();
+            auto pending = ctx.send(response); // Destroyed unstarted, only the building is measured
+            keep(ctx);
+        }, bytes);
+    };
+
+    measure("send, sized text", Text{{}, "Hello, World!"});
+    measure("send, unsized text", UnsizedText{{}, "Hello, World!"});
+    measure("send, json message", json::From(Message{"Hello, World!"}));
+    measure("send, status only", htpp::Response{204});
+
+    std::array<std::string_view, 8> extensions{".html", ".css", ".js", ".png", ".woff2", ".json", ".svg", ".unknown"};
+    std::size_t next = 0;
+    run("from_file_extension", [&]{
+        keep(htpp::from_file_extension(extensions[next++ % extensions.size()]));
+    });
+}
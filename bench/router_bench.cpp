@@ -0,0 +1,66 @@
+#include "bench.h"
+#include "router.h"
+#include <htpp/routes.h>
+
+#include <array>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace{
+    asio::awaitable<void> handler(htpp::Context&, std::string_view){ co_return; }
+}
+
+// Lookup cost as the route table grows, paths mix static routes and {param} captures
+void bench::router_benchmarks(){
+    using enum htpp::RequestType;
+    for(std::size_t count : {10, 100, 1000, 10000}){
+        htpp::Router router;
+        std::vector<std::string> paths;
+        for(std::size_t i = 0; i < count; i++){
+            auto index = std::to_string(i);
+            router.add(GET, "/api/resource" + index + "/{id}/orders", handler);
+            router.add(POST, "/api/resource" + index + "/static", handler);
+            paths.push_back("/api/resource" + index + "/" + std::to_string(i * 7) + "/orders");
+            paths.push_back("/api/resource" + index + "/static");
+        }
+        std::shuffle(paths.begin(), paths.end(), std::mt19937{42});
+
+        std::array<htpp::PathParam, htpp::Context::max_path_params> params;
+        std::size_t next = 0;
+        run("router lookup, " + std::to_string(router.size()) + " routes", [&]{
+            const auto& path = paths[next++ % paths.size()];
+            auto match = router.find(path.ends_with("static") ? POST : GET, path, params);
+            keep(match);
+        });
+    }
+
+    using Table = htpp::StaticRoutes<
+        htpp::Route<GET, "/", handler>,
+        htpp::Route<GET, "/json", handler>,
+        htpp::Route<GET, "/api/time", handler>,
+        htpp::Route<POST, "/api/time", handler>,
+        htpp::Route<GET, "/api/users", handler>,
+        htpp::Route<POST, "/api/users", handler>,
+        htpp::Route<GET, "/api/orders", handler>,
+        htpp::Route<GET, "/health", handler>>;
+    htpp::Router router;
+    std::array<std::pair<htpp::RequestType, std::string_view>, 8> lookups{{
+        {GET, "/"}, {GET, "/json"}, {GET, "/api/time"}, {POST, "/api/time"},
+        {GET, "/api/users"}, {POST, "/api/users"}, {GET, "/api/orders"}, {GET, "/health"}
+    }};
+    for(auto [type, path] : lookups)
+        router.add(type, path, handler);
+
+    std::array<htpp::PathParam, htpp::Context::max_path_params> params;
+    std::size_t next = 0;
+    run("router lookup, 8 routes", [&]{
+        auto [type, path] = lookups[next++ % lookups.size()];
+        keep(router.find(type, path, params));
+    });
+    run("static route table lookup, 8 routes", [&]{
+        auto [type, path] = lookups[next++ % lookups.size()];
+        keep(Table::find(type, path));
+    });
+}
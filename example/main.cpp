@@ -1,12 +1,13 @@
 #include <htpp/lib.h>
 #include <htpp/json.h>
+#include <htpp/routes.h>
 
 #include <iostream>
 #include <string>
-#include <sstream>
 #include <utility>
-#include <mutex>
 #include <ctime>
+#include <ranges>
+#include <optional>
 
 struct TimeResponse{
     using json_names = json::key_name<"hour", "minute", "second">;
@@ -33,28 +34,85 @@ asio::awaitable<void> handle_json(htpp::Context& ctx, std::string_view){
     return ctx.send(json::From(Msg{"Hello, World!"}));
 }
 
-class Logger : public htpp::Middleware{
-    std::ostream& os;
-    std::mutex stream_lock;
-public:
-    explicit Logger(std::ostream& os) : os{os} {}
-    void on_received(const htpp::Request& request) override {
-        auto lock = std::unique_lock{stream_lock};
-        os << to_str(request.type) << ' ' << request.url << '\n';
+asio::awaitable<void> handle_greet(htpp::Context& ctx, std::string_view){
+    return ctx.send(json::From(Msg{ctx.path_param("name")}));
+}
+
+struct GreetRequest{
+    using json_names = json::key_name<"name">;
+    std::string name; // Client text may hold escapes, a std::string_view member would need json::parse(text, storage)
+};
+
+// Malformed bodies are answered with 400 by the ParseError json::parse throws
+asio::awaitable<void> handle_greet_post(htpp::Context& ctx, std::string_view){
+    auto request = json::parse<GreetRequest>(co_await ctx.body());
+    co_await ctx.send(json::From(Msg{request.name}));
+}
+
+asio::awaitable<void> handle_agent(htpp::Context& ctx, std::string_view){
+    auto agent = ctx.request().headers.get(htpp::Header::UserAgent);
+    return ctx.send(json::From(Msg{agent.value_or("unknown")}));
+}
+
+asio::awaitable<void> handle_echo(htpp::Context& ctx, std::string_view){
+    auto body = co_await ctx.body();
+    co_await ctx.send(json::From(Msg{body}));
+}
+
+struct UploadResponse{
+    using json_names = json::key_name<"bytes">;
+    std::size_t bytes;
+};
+
+// Streams the body instead of buffering it, so uploads of any size are fine
+asio::awaitable<void> handle_upload(htpp::Context& ctx, std::string_view){
+    UploadResponse response{0};
+    for(auto piece = co_await ctx.read_body(); !piece.empty(); piece = co_await ctx.read_body())
+        response.bytes += piece.size();
+    co_await ctx.send(json::From(response));
+}
+
+// Large responses go out in chunks while they are being generated
+asio::awaitable<void> handle_squares(htpp::Context& ctx, std::string_view){
+    auto stream = ctx.stream(htpp::OkResponse{}, htpp::ContentType::ApplicationJson);
+    co_await json::stream_array(stream, std::views::iota(0LL, 100000LL) | std::views::transform([](long long i){ return i * i; }));
+    co_await stream.finish();
+}
+
+// Plain types composed with htpp::MiddlewareChain only implement the hooks they need, without virtual calls
+struct HideDotfiles{
+    std::optional<htpp::Rejection> before_handler(const htpp::Context& ctx) const {
+        if(ctx.request().url.contains("/."))
+            return htpp::Rejection{404, "404 Not Found"};
+        return std::nullopt;
     }
 };
 
 int main(){
     using enum htpp::RequestType;
+    using StaticRoutes = htpp::StaticRoutes<
+        htpp::Route<GET, "/json", handle_json>,
+        htpp::Route<GET, "/api/time", handle_time>>;
 
     htpp::Server{}
         // .use_https("localhost.pem", "localhost-key.pem")
         .set_threads(4)
+        .set_thread_mode(htpp::ThreadMode::Sharded)
         .set_static_files("/", STATIC_FILE_DIR)
-        .add_middleware<Logger>(std::cout)
+        .set_static_cache(16 * 1024 * 1024)
+        .set_compression()
+        .set_metrics()
+        .add_middleware<htpp::MiddlewareChain<HideDotfiles>>()
+        .set_access_log("access.log", htpp::AccessLogFormat::Combined)
+        .stop_on_signals()
+        .set_routes(StaticRoutes{})
         .set_routes({
-            {GET, "/json", handle_json},
-            {GET, "/api/time", handle_time}
+            {GET, "/api/greet/{name}", handle_greet},
+            {POST, "/api/greet", handle_greet_post},
+            {GET, "/api/agent", handle_agent},
+            {POST, "/api/echo", handle_echo},
+            {POST, "/api/upload", handle_upload},
+            {GET, "/api/squares", handle_squares}
         })
         .run();
 }
\ No newline at end of file
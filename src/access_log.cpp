@@ -0,0 +1,203 @@
+#include "access_log.h"
+
+#include <array>
+#include <charconv>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace htpp{
+    namespace{
+        constexpr std::size_t max_line = 4096; // Longer entries have their quoted fields cut short
+
+        // Line being formatted on the request thread, appends past the end are ignored
+        struct Line{
+            std::array<char, max_line> data;
+            std::size_t size{0};
+
+            Line& operator<<(std::string_view str){
+                auto count = std::min(str.size(), data.size() - size);
+                std::memcpy(data.data() + size, str.data(), count);
+                size += count;
+                return *this;
+            }
+
+            Line& operator<<(char c){
+                if(size < data.size())
+                    data[size++] = c;
+                return *this;
+            }
+
+            template<typename T> requires std::integral<T> && (!std::same_as<T, char>)
+            Line& operator<<(T value){
+                auto [end, ec] = std::to_chars(data.data() + size, data.data() + data.size(), value);
+                if(ec == std::errc{})
+                    size = static_cast<std::size_t>(end - data.data());
+                return *this;
+            }
+
+            // Quote and backslash escaped, control bytes written as \xHH (\u00HH in JSON) so a request can't forge log lines
+            Line& escaped(std::string_view str, bool json = false){
+                constexpr std::string_view hex{"0123456789abcdef"};
+                for(char c : str){
+                    auto byte = static_cast<unsigned char>(c);
+                    if(c == '"' || c == '\\')
+                        *this << '\\' << c;
+                    else if(byte < 0x20 || byte == 0x7f)
+                        *this << (json ? "\\u00" : "\\x") << hex[byte >> 4] << hex[byte & 0xf];
+                    else
+                        *this << c;
+                }
+                return *this;
+            }
+
+            std::string_view view() const { return {data.data(), size}; }
+        };
+
+        constexpr std::array<std::string_view, 12> months{"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+        // Timestamps only change once a second, each thread keeps its last rendering
+        struct Timestamps{
+            std::time_t second{-1};
+            std::array<char, 32> common;  // 17/Oct/2026:22:46:56 +0000
+            std::array<char, 32> iso;     // 2026-10-17T22:46:56Z
+            std::size_t common_size{0};
+            std::size_t iso_size{0};
+
+            void update(std::time_t now){
+                if(now == second)
+                    return;
+                second = now;
+                tm utc; gmtime_r(&now, &utc);
+                auto common_end = std::strftime(common.data(), common.size(), "%d/", &utc);
+                auto month_name = months[static_cast<std::size_t>(utc.tm_mon)];
+                std::memcpy(common.data() + common_end, month_name.data(), month_name.size());
+                common_end += month_name.size();
+                common_end += std::strftime(common.data() + common_end, common.size() - common_end, "/%Y:%H:%M:%S +0000", &utc);
+                common_size = common_end;
+                iso_size = std::strftime(iso.data(), iso.size(), "%Y-%m-%dT%H:%M:%SZ", &utc);
+            }
+        };
+
+        void write_remote(Line& line, const ConnectionInfo& connection){
+            auto address = connection.remote.address();
+            if(address.is_v6() && address.to_v6().is_v4_mapped())
+                address = asio::ip::make_address_v4(asio::ip::v4_mapped, address.to_v6());
+            asio::error_code ec;
+            auto written = address.to_string(ec);
+            line << (ec ? std::string_view{"-"} : std::string_view{written});
+        }
+
+        std::string_view version_name(Version version){
+            return version == Version::Http10 ? "HTTP/1.0" : "HTTP/1.1";
+        }
+    }
+
+    AccessLog::AccessLog(const std::filesystem::path& file, AccessLogFormat format): format{format} {
+        fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if(fd < 0)
+            throw std::runtime_error{"Can't open access log " + file.string()};
+        flusher = std::jthread{[this](std::stop_token stop){ flush_loop(stop); }};
+    }
+
+    AccessLog::~AccessLog(){
+        flusher.request_stop();
+        flusher.join();
+        ::close(fd);
+    }
+
+    AccessLog::Ring& AccessLog::local_ring(){
+        struct Cached{ uint64_t owner; Ring* ring; };
+        thread_local Cached cached{~uint64_t{0}, nullptr};
+        if(cached.owner != id){
+            auto guard = std::lock_guard{rings_lock};
+            cached = {id, rings.emplace_back(std::make_unique<Ring>()).get()};
+        }
+        return *cached.ring;
+    }
+
+    void AccessLog::record(const Context& ctx, const ResponseInfo& info){
+        thread_local Timestamps timestamps;
+        timestamps.update(std::time(nullptr));
+
+        const auto& request = ctx.request();
+        auto referer = request.headers.get(Header::Referer);
+        auto agent = request.headers.get(Header::UserAgent);
+        Line line;
+        if(format == AccessLogFormat::Json){
+            line << "{\"time\":\"" << std::string_view{timestamps.iso.data(), timestamps.iso_size} << "\",\"remote\":\"";
+            write_remote(line, ctx.connection_info());
+            line << "\",\"method\":\"" << to_str(request.type) << "\",\"url\":\"";
+            line.escaped(request.url, true);
+            line << "\",\"query\":\"";
+            line.escaped(request.param, true);
+            line << "\",\"version\":\"" << version_name(request.version) << "\",\"status\":" << info.status << ",\"bytes\":" << info.bytes
+                 << ",\"duration_us\":" << std::chrono::duration_cast<std::chrono::microseconds>(info.duration).count() << ",\"referer\":\"";
+            line.escaped(referer.value_or(""), true);
+            line << "\",\"user_agent\":\"";
+            line.escaped(agent.value_or(""), true);
+            line << "\"}";
+        }else{
+            write_remote(line, ctx.connection_info());
+            line << " - - [" << std::string_view{timestamps.common.data(), timestamps.common_size} << "] \"" << to_str(request.type) << ' ';
+            line.escaped(request.url);
+            if(!request.param.empty())
+                (line << '?').escaped(request.param);
+            line << ' ' << version_name(request.version) << "\" " << info.status << ' ' << info.bytes;
+            if(format == AccessLogFormat::Combined){
+                line << " \"";
+                line.escaped(referer.value_or("-"));
+                line << "\" \"";
+                line.escaped(agent.value_or("-"));
+                line << '"';
+            }
+        }
+        if(line.size == line.data.size())
+            line.size--; // Keep room for the newline of a cut entry
+        line << '\n';
+
+        if(!local_ring().push(line.view()))
+            dropped_entries.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::size_t AccessLog::drain(std::vector<char>& batch){
+        batch.clear();
+        auto guard = std::lock_guard{rings_lock};
+        for(const auto& ring : rings){
+            auto tail = ring->tail.load(std::memory_order_relaxed);
+            auto head = ring->head.load(std::memory_order_acquire);
+            for(auto position = tail; position != head;){
+                auto offset = position % Ring::capacity;
+                auto count = std::min(head - position, Ring::capacity - offset);
+                batch.insert(batch.end(), ring->data.get() + offset, ring->data.get() + offset + count);
+                position += count;
+            }
+            ring->tail.store(head, std::memory_order_release);
+        }
+        return batch.size();
+    }
+
+    void AccessLog::flush_loop(std::stop_token stop){
+        std::vector<char> batch;
+        while(true){
+            {
+                auto lock = std::unique_lock{wake_lock};
+                wake.wait_for(lock, stop, flush_interval, []{ return false; });
+            }
+            auto stopping = stop.stop_requested();
+            for(std::size_t written = 0, size = drain(batch); written < size;){
+                auto result = ::write(fd, batch.data() + written, size - written);
+                if(result < 0 && errno == EINTR)
+                    continue;
+                if(result <= 0)
+                    break; // Nothing sensible to do about a failing log, keep serving
+                written += static_cast<std::size_t>(result);
+            }
+            if(stopping)
+                return;
+        }
+    }
+}
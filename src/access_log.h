@@ -0,0 +1,68 @@
+#pragma once
+#include <htpp/lib.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace htpp{
+    // Access log that never blocks a request. Entries are formatted on the request thread into that thread's ring,
+    // a background thread drains all rings to the file in batches. Entries that don't fit are dropped and counted.
+    class AccessLog{
+        // Single producer single consumer byte ring, entries are whole lines so the consumer copies bytes blindly
+        struct Ring{
+            static constexpr std::size_t capacity = 256 * 1024;
+            std::unique_ptr<char[]> data{std::make_unique_for_overwrite<char[]>(capacity)};
+            alignas(64) std::atomic<std::size_t> head{0}; // Written by the producer
+            alignas(64) std::atomic<std::size_t> tail{0}; // Written by the consumer
+
+            bool push(std::string_view line){
+                auto write = head.load(std::memory_order_relaxed);
+                if(capacity - (write - tail.load(std::memory_order_acquire)) < line.size())
+                    return false;
+                auto offset = write % capacity;
+                auto first = std::min(line.size(), capacity - offset);
+                std::memcpy(data.get() + offset, line.data(), first);
+                std::memcpy(data.get(), line.data() + first, line.size() - first);
+                head.store(write + line.size(), std::memory_order_release);
+                return true;
+            }
+        };
+
+        static constexpr auto flush_interval = std::chrono::milliseconds(100);
+
+        static inline std::atomic<uint64_t> next_id{0};
+        uint64_t id{next_id.fetch_add(1, std::memory_order_relaxed)}; // Tells thread local ring caches of different logs apart
+        AccessLogFormat format;
+        int fd;
+        std::atomic<std::size_t> dropped_entries{0};
+        std::mutex rings_lock;
+        std::vector<std::unique_ptr<Ring>> rings; // Rings of exited threads stay until drained with the rest
+        std::mutex wake_lock;
+        std::condition_variable_any wake;
+        std::jthread flusher;
+
+        Ring& local_ring();
+        std::size_t drain(std::vector<char>& batch);
+        void flush_loop(std::stop_token stop);
+
+    public:
+        AccessLog(const std::filesystem::path& file, AccessLogFormat format);
+        AccessLog(const AccessLog&) = delete;
+        AccessLog& operator=(const AccessLog&) = delete;
+        ~AccessLog(); // Stops the flusher after a final drain
+
+        void record(const Context& ctx, const ResponseInfo& info);
+
+        std::size_t dropped() const { return dropped_entries.load(std::memory_order_relaxed); }
+    };
+}
@@ -0,0 +1,114 @@
+#pragma once
+#include <htpp/lib.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+// Per-thread free list of fixed size blocks, connections draw from it while a request is in flight
+class BufferPool{
+    struct Counters{
+        std::atomic<std::size_t> allocated{0};
+        std::atomic<std::size_t> reused{0};
+        std::atomic<std::size_t> released{0};
+        std::atomic<std::size_t> grown{0};
+        std::atomic<std::size_t> in_use{0};
+    };
+    static Counters& counters(){
+        static Counters instance;
+        return instance;
+    }
+
+    static std::vector<std::unique_ptr<char[]>>& free_list(){
+        thread_local std::vector<std::unique_ptr<char[]>> blocks;
+        return blocks;
+    }
+public:
+    static constexpr std::size_t block_size = 16 * 1024;
+    static constexpr std::size_t max_free_blocks = 4096; // Per thread, 64MB worst case
+
+    static std::unique_ptr<char[]> acquire(){
+        counters().in_use.fetch_add(1, std::memory_order_relaxed);
+        auto& blocks = free_list();
+        if(blocks.empty()){
+            counters().allocated.fetch_add(1, std::memory_order_relaxed);
+            return std::make_unique_for_overwrite<char[]>(block_size);
+        }
+        counters().reused.fetch_add(1, std::memory_order_relaxed);
+        auto block = std::move(blocks.back());
+        blocks.pop_back();
+        return block;
+    }
+
+    static void release(std::unique_ptr<char[]> block){
+        counters().in_use.fetch_sub(1, std::memory_order_relaxed);
+        counters().released.fetch_add(1, std::memory_order_relaxed);
+        auto& blocks = free_list();
+        if(blocks.size() < max_free_blocks)
+            blocks.push_back(std::move(block));
+    }
+
+    static void record_growth(){
+        counters().grown.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static htpp::BufferPoolStats stats(){
+        return {
+            counters().allocated.load(std::memory_order_relaxed),
+            counters().reused.load(std::memory_order_relaxed),
+            counters().released.load(std::memory_order_relaxed),
+            counters().grown.load(std::memory_order_relaxed),
+            counters().in_use.load(std::memory_order_relaxed)
+        };
+    }
+};
+
+// Request storage that starts as a pooled block and only grows towards max_size when a request needs it
+class RequestBuffer{
+    std::unique_ptr<char[]> storage;
+    std::size_t capacity{0};
+    std::size_t max_size;
+public:
+    explicit RequestBuffer(std::size_t max_size): max_size{max_size} {}
+    RequestBuffer(const RequestBuffer&) = delete;
+    RequestBuffer& operator=(const RequestBuffer&) = delete;
+    ~RequestBuffer(){ release(); }
+
+    char* data(){ return storage.get(); }
+    const char* data() const { return storage.get(); }
+    bool empty() const { return storage == nullptr; }
+    std::size_t size() const { return std::min(capacity, max_size); }
+    bool at_limit() const { return capacity >= max_size; }
+
+    void acquire(){
+        if(storage == nullptr){
+            storage = BufferPool::acquire();
+            capacity = BufferPool::block_size;
+        }
+    }
+
+    // Invalidates all pointers into the buffer, check at_limit first
+    void grow(std::size_t used){
+        if(at_limit())
+            throw std::length_error{"Request too large"};
+        auto new_capacity = std::min(capacity * 2, max_size);
+        auto bigger = std::make_unique_for_overwrite<char[]>(new_capacity);
+        std::memcpy(bigger.get(), storage.get(), used);
+        release();
+        storage = std::move(bigger);
+        capacity = new_capacity;
+        BufferPool::record_growth();
+    }
+
+    void release(){
+        if(storage == nullptr)
+            return;
+        if(capacity == BufferPool::block_size)
+            BufferPool::release(std::move(storage));
+        storage.reset();
+        capacity = 0;
+    }
+};
@@ -0,0 +1,124 @@
+#include "compression.h"
+#include <htpp/response.h>
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <zlib.h>
+#ifdef HTPP_HAS_BROTLI
+#include <brotli/encode.h>
+#endif
+
+namespace htpp{
+    namespace{
+        std::string_view trim(std::string_view str){
+            while(!str.empty() && (str.front() == ' ' || str.front() == '\t'))
+                str.remove_prefix(1);
+            while(!str.empty() && (str.back() == ' ' || str.back() == '\t'))
+                str.remove_suffix(1);
+            return str;
+        }
+
+        std::string gzip(std::string_view data, int level){
+            z_stream stream{};
+            if(deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+                throw std::runtime_error{"Failed to initialize gzip"};
+
+            std::string out;
+            out.resize(deflateBound(&stream, static_cast<uLong>(data.size())));
+            stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+            stream.avail_in = static_cast<uInt>(data.size());
+            stream.next_out = reinterpret_cast<Bytef*>(out.data());
+            stream.avail_out = static_cast<uInt>(out.size());
+            auto result = deflate(&stream, Z_FINISH);
+            out.resize(stream.total_out);
+            deflateEnd(&stream);
+            if(result != Z_STREAM_END)
+                throw std::runtime_error{"Failed to gzip response"};
+            return out;
+        }
+
+#ifdef HTPP_HAS_BROTLI
+        std::string brotli(std::string_view data, int quality){
+            std::string out;
+            std::size_t size = BrotliEncoderMaxCompressedSize(data.size());
+            out.resize(size);
+            if(!BrotliEncoderCompress(quality, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, data.size(),
+                    reinterpret_cast<const uint8_t*>(data.data()), &size, reinterpret_cast<uint8_t*>(out.data())))
+                throw std::runtime_error{"Failed to brotli compress response"};
+            out.resize(size);
+            return out;
+        }
+#endif
+    }
+
+    Encoding parse_accept_encoding(std::string_view header){
+        Encoding accepted = Encoding::Identity;
+        while(!header.empty()){
+            auto comma = header.find(',');
+            auto token = header.substr(0, comma);
+            header.remove_prefix(comma == std::string_view::npos ? header.size() : comma + 1);
+
+            auto semicolon = token.find(';');
+            auto name = trim(token.substr(0, semicolon));
+            if(semicolon != std::string_view::npos){
+                auto weight = trim(token.substr(semicolon + 1));
+                if(weight == "q=0" || (weight.starts_with("q=0.") && weight.find_first_not_of('0', 4) == std::string_view::npos))
+                    continue;
+            }
+            // Coding names are case-insensitive, RFC 9110 8.4.1
+            if(iequals_ascii(name, "gzip"))
+                accepted = accepted | Encoding::Gzip;
+            else if(iequals_ascii(name, "br"))
+                accepted = accepted | Encoding::Brotli;
+            else if(name == "*")
+                accepted = accepted | Encoding::Gzip | Encoding::Brotli;
+        }
+        return accepted;
+    }
+
+    bool is_compressible(ContentType type){
+        using enum ContentType;
+        constexpr std::array compressible{
+            TextPlain, TextHtml, TextCss, TextCsv, TextCalendar, TextJavascript,
+            ApplicationJson, ApplicationLdJson, ApplicationXml, ApplicationXHtml, ImageSvg
+        };
+        return std::find(compressible.begin(), compressible.end(), type) != compressible.end();
+    }
+
+    Encoding preferred_encoding(Encoding accepted){
+#ifdef HTPP_HAS_BROTLI
+        if(has(accepted, Encoding::Brotli))
+            return Encoding::Brotli;
+#endif
+        if(has(accepted, Encoding::Gzip))
+            return Encoding::Gzip;
+        return Encoding::Identity;
+    }
+
+    std::string compress(Encoding encoding, std::string_view data, bool favor_size){
+        switch(encoding){
+            case Encoding::Gzip: return gzip(data, favor_size ? 9 : 5);
+#ifdef HTPP_HAS_BROTLI
+            case Encoding::Brotli: return brotli(data, favor_size ? 9 : 4);
+#else
+            case Encoding::Brotli: return {};
+#endif
+            case Encoding::Identity: return {};
+        }
+        return {};
+    }
+
+    bool Context::compress_body(ContentType type, std::string_view body, std::string& out, std::string_view& encoding_name) const {
+        if(body.size() < compression_min_size || !is_compressible(type))
+            return false;
+        auto encoding = preferred_encoding(accepted_encodings);
+        if(encoding == Encoding::Identity)
+            return false;
+        out = compress(encoding, body);
+        if(out.empty() || out.size() >= body.size())
+            return false;
+        encoding_name = to_str(encoding);
+        return true;
+    }
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include <htpp/http.h>
+
+#include <string>
+#include <string_view>
+
+namespace htpp{
+    Encoding parse_accept_encoding(std::string_view header);
+    bool is_compressible(ContentType type);
+
+    // Picks the best encoding both sides support, Identity when the server has no codec for any of them
+    Encoding preferred_encoding(Encoding accepted);
+
+    // Returns an empty string if the encoding is unavailable
+    std::string compress(Encoding encoding, std::string_view data, bool favor_size = false);
+}
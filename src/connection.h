@@ -1,155 +1,526 @@
 #pragma once
-#include <htpp/http.h>
-#include "connection.h"
+#include <htpp/lib.h>
+#include "compression.h"
 #include "utilites.h"
+#include "buffer_pool.h"
+#include "static_cache.h"
+#include "date_cache.h"
+#include "router.h"
+#include "request_parser.h"
+#include "metrics.h"
+#include "shutdown.h"
 
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <asio.hpp>
 #include <string_view>
-#include <limits>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <charconv>
+#include <cstring>
+#include <span>
+#include <vector>
 #include <concepts>
 
 template<typename T>
 concept Connection = requires (T t) {
     {t.init()} -> std::same_as<asio::awaitable<void>>;
+    {t.remote_endpoint()} -> std::same_as<asio::ip::tcp::endpoint>;
+    {T::secure} -> std::convertible_to<bool>;
+    {t.wait_readable()} -> std::same_as<asio::awaitable<void>>;
     {t.receive(asio::mutable_buffer{})} -> std::same_as<asio::awaitable<std::size_t>>;
     {t.write(asio::const_buffer{})} -> std::same_as<asio::awaitable<size_t>>;
-    {t.available()} -> std::same_as<std::size_t>;
+    {t.write(std::span<const asio::const_buffer>{})} -> std::same_as<asio::awaitable<size_t>>;
+    {t.write_file(std::span<const asio::const_buffer>{}, int{}, std::size_t{})} -> std::same_as<asio::awaitable<void>>;
+    {std::as_const(t).written()} -> std::same_as<std::size_t>;
     {t.get_executor()} -> std::same_as<asio::any_io_executor>;
     {t.is_open()} -> std::same_as<bool>;
+    {t.cancel()};
     {t.close()} -> std::same_as<asio::awaitable<void>>;
 };
 
 template<Connection ConnectionType>
-class HttpProtocol : public htpp::Context{
-    static constexpr int keepalive_timeout = 30;
+class HttpProtocol : public htpp::Context, public htpp::Drainable, public std::enable_shared_from_this<HttpProtocol<ConnectionType>>{
+    static constexpr auto keepalive_timeout = std::chrono::seconds(30);
+    static constexpr auto request_timeout = std::chrono::seconds(10);
+    static constexpr auto write_timeout = std::chrono::seconds(30); // Without any byte leaving, a client that stopped reading
 
-    char* it;
-    char* end;
-    size_t bytes_left;
+    static constexpr std::size_t max_coalesced_response = 64 * 1024;
+
+    RequestBuffer buffer;
+    std::size_t filled{0};
+    std::size_t head_size{0};
+    std::size_t consumed{0}; // Bytes belonging to the request being handled
+    std::size_t max_body_size;
+
+    // Body framing of the current request, for chunked bodies body_remaining counts down the current chunk
+    std::size_t body_remaining{0};
+    bool body_complete{true};
+    bool chunked{false};
+    bool first_chunk{true};
+    bool expect_continue{false};
+    std::string body_storage;
+    std::vector<asio::const_buffer> gathered;
+    std::vector<std::shared_ptr<const void>> retained; // Owners of borrowed response bytes
+    bool responded{false}; // Part of the answer to the current request has been handed to the connection
+    bool idle{false}; // Waiting for the next request
+    bool draining{false}; // The server is stopping, no request after the current one
+
+    bool metrics;
+    bool timed; // Metrics, middleware or the access log want durations
+    std::chrono::steady_clock::time_point request_start;
+    std::size_t bytes_sent{0};
+    std::size_t response_start{0}; // bytes_sent plus the buffered bytes when the current request began
 public:
+    std::string_view route_label; // Pattern the current request was served by, labels its metrics
     ConnectionType connection;
-    std::time_t connection_keepalive{std::time(nullptr) + keepalive_timeout};
+    using htpp::Context::keep_alive;
+private:
+    // Single deadline per connection, all work on the connection is serialized through its strand
+    asio::steady_timer deadline;
+public:
 
-    explicit HttpProtocol(ConnectionType connection): connection{std::move(connection)} {}
+    HttpProtocol(ConnectionType connection, const htpp::Server& server)
+        : buffer{server.max_request_size}, max_body_size{server.max_request_size}, metrics{!server.metrics_path.empty()},
+          timed{metrics || !server.middlewares.empty() || server.access_log}, connection{std::move(connection)}, deadline{asio::make_strand(this->connection.get_executor())} {
+        compression_min_size = server.compression_min_size;
+        current_connection = {this->connection.remote_endpoint(), ConnectionType::secure};
+        if(metrics)
+            htpp::Metrics::connection_opened();
+    }
     HttpProtocol(const HttpProtocol&) = delete;
     HttpProtocol& operator=(const HttpProtocol&) = delete;
-    HttpProtocol(HttpProtocol&&) noexcept = default;
-    HttpProtocol& operator=(HttpProtocol&&) noexcept = default;
+    ~HttpProtocol(){
+        if(metrics)
+            htpp::Metrics::connection_closed();
+    }
+
+    asio::any_io_executor get_executor(){
+        return deadline.get_executor();
+    }
+
+    htpp::Router::Match route(const htpp::Router& router, const htpp::Request& request){
+        auto match = router.find(request.type, request.url, path_param_storage);
+        path_param_count = match.param_count;
+        return match;
+    }
+
+    htpp::Encoding accepted_encoding() const {
+        return accepted_encodings;
+    }
+
+    // Cancels whatever the connection is waiting on once the timeout expires, rearming replaces the previous deadline
+    void expires_after(std::chrono::steady_clock::duration timeout){
+        deadline.expires_after(timeout);
+        deadline.async_wait([weak = this->weak_from_this()](const asio::error_code& ec){
+            if(ec)
+                return; // Rearmed or cancelled
+            if(auto self = weak.lock(); self && self->expired())
+                self->connection.cancel();
+        });
+    }
+
+    // Bounds a response write, a client still reading keeps it going however long it takes, a stalled one is cut
+    void write_expires_after(std::chrono::steady_clock::duration timeout){
+        deadline.expires_after(timeout);
+        deadline.async_wait([weak = this->weak_from_this(), progress = connection.written(), timeout](const asio::error_code& ec){
+            if(ec)
+                return; // Rearmed or cancelled
+            if(auto self = weak.lock(); self && self->expired()){
+                if(self->connection.written() != progress)
+                    self->write_expires_after(timeout);
+                else
+                    self->connection.cancel();
+            }
+        });
+    }
+
+    void cancel_deadline(){
+        deadline.expires_at(std::chrono::steady_clock::time_point::max());
+    }
 
-    template<size_t N>
-    void set_buffer(char (& buffer)[N]){
-        it = buffer;
-        end = it;
-        bytes_left = N;
+    // A completion already queued when the deadline was cancelled or rearmed still runs without an error
+    bool expired() const {
+        return deadline.expiry() <= std::chrono::steady_clock::now();
+    }
+
+    void drain() override {
+        asio::post(get_executor(), [self = this->shared_from_this()]{
+            self->draining = true;
+            self->keep_alive = false; // The response in progress announces the close
+            if(self->idle)
+                self->connection.cancel();
+        });
+    }
+
+    void abort() override {
+        asio::post(get_executor(), [self = this->shared_from_this()]{
+            self->connection.cancel();
+        });
     }
 
     asio::awaitable<void> init(){
+        expires_after(request_timeout);
         co_await connection.init();
     }
 
     asio::awaitable<void> receive(){
-        while(connection.available() == 0){
-            if(connection_keepalive < std::time(nullptr) || !connection.is_open()){
-                throw std::logic_error{"Timed out"}; // Convert to return value error handling or custom exception
+        if(buffer.empty()){
+            co_await receive_idle(); // Idle connections hold no buffer
+            co_return;
+        }
+        if(filled == buffer.size()){
+            if(buffer.at_limit()){
+                if(timed)
+                    request_start = std::chrono::steady_clock::now();
+                throw htpp::HttpError{431, "Request Header Fields Too Large"};
             }
-            auto timer = asio::high_resolution_timer{connection.get_executor()};
-            timer.expires_after(std::chrono::nanoseconds(10)); // Scales very poorly
-            co_await timer.async_wait(asio::use_awaitable);
+            buffer.grow(filled);
         }
-        auto count = co_await connection.receive(asio::buffer(end, bytes_left));
-        end += count;
-        bytes_left -= count;
+        co_await receive_some();
     }
 
-    asio::awaitable<void> wait_for_count(size_t bytes){
-        while(static_cast<size_t>(std::distance(it, end)) < bytes)
-            co_await receive();
+    // Waits for the first bytes of the next request. TLS only knows there is a request once a read returns
+    // decrypted bytes, so the connection stays idle, and drain() may cancel it, until that first read is done.
+    asio::awaitable<void> receive_idle(){
+        if(draining)
+            throw asio::system_error{asio::error::operation_aborted};
+        struct Leave{
+            HttpProtocol& self;
+            ~Leave(){ // Also when the wait is cancelled
+                self.idle = false;
+                if(self.metrics)
+                    htpp::Metrics::idle_left();
+            }
+        } leave{*this};
+        idle = true;
+        if(metrics)
+            htpp::Metrics::idle_entered();
+        co_await connection.wait_readable();
+        buffer.acquire();
+        co_await receive_some();
     }
 
-    asio::awaitable<void> find_first_of(std::string_view matches){
-        while(it = std::find_first_of(it, end, matches.begin(), matches.end()), it == end)
-            co_await receive();
+    asio::awaitable<void> receive_some(){
+        auto received = co_await connection.receive(asio::buffer(buffer.data() + filled, buffer.size() - filled));
+        filled += received;
+        if(metrics)
+            htpp::Metrics::received(received);
     }
 
-    asio::awaitable<void> find(char match){
-        while(it = std::find(it, end, match), it == end)
+    // Receives until the blank line terminating the request head, returns the length of the head
+    asio::awaitable<std::size_t> receive_head(){
+        expires_after(keepalive_timeout);
+        std::size_t scanned = 0;
+        while(true){
+            std::string_view data{buffer.data(), filled};
+            auto pos = data.find("\r\n\r\n", scanned);
+            if(pos != std::string_view::npos)
+                co_return pos + 4;
+            scanned = filled < 3 ? 0 : filled - 3;
             co_await receive();
+            expires_after(request_timeout);
+        }
     }
 
-    asio::awaitable<htpp::Request> parse_request(){
-        co_await wait_for_count(8);
-        auto type = get_type(it);
+    // Fills request(), its views remain valid until finish_request
+    asio::awaitable<void> parse_request(){
+        responded = false;
+        response_status = 0;
+        route_label = {};
+        response_start = bytes_sent + response_buffer.size();
+        // A request rejected part way still reaches after_response, nothing may point at the previous one
+        current_request.url = {};
+        current_request.param = {};
+        current_request.headers.clear();
+        head_size = co_await receive_head();
+        cancel_deadline();
+        if(timed)
+            request_start = std::chrono::steady_clock::now();
+        consumed = head_size;
+        auto headers = htpp::parse_request_line({buffer.data(), head_size}, current_request);
+
+        keep_alive = current_request.version == htpp::Version::Http11;
+        accepted_encodings = htpp::Encoding::Identity;
+        body_remaining = 0;
+        body_complete = true;
+        chunked = false;
+        first_chunk = true;
+        expect_continue = false;
+        htpp::tokenize_headers({headers, buffer.data() + head_size}, current_request.headers);
+        apply_headers();
+        if(draining)
+            keep_alive = false;
+    }
 
-        auto start = it;
-        co_await find_first_of("? ");
-        std::string_view url{start, it};
-        std::string_view param;
-        if(*it == '?'){ // request contains parameters parse those
-            start = ++it;
-            find(' ');
-            param = {start, it};
+    // Picks up the headers that change how the connection handles this request
+    void apply_headers(){
+        using enum htpp::Header;
+        std::optional<std::size_t> content_length;
+        bool transfer_encoding = false;
+        for(const auto& field : current_request.headers){
+            if(field.id == Connection)
+                keep_alive = htpp::iequals_ascii(field.value, "close") ? false : htpp::iequals_ascii(field.value, "keep-alive") || keep_alive;
+            else if(field.id == AcceptEncoding)
+                accepted_encodings = htpp::parse_accept_encoding(field.value);
+            else if(field.id == ContentLength){
+                auto length = parse_content_length(field.value);
+                if(content_length.has_value() && *content_length != length)
+                    throw htpp::HttpError{400, "Bad Request"}; // Which length a proxy in front used is unknowable, RFC 9112 6.3
+                content_length = length;
+            }
+            else if(field.id == TransferEncoding){
+                if(transfer_encoding || !htpp::iequals_ascii(field.value, "chunked"))
+                    throw htpp::HttpError{501, "Not Implemented"};
+                transfer_encoding = true;
+            }
+            else if(field.id == Expect)
+                expect_continue = htpp::iequals_ascii(field.value, "100-continue");
         }
+        // Both framings in one request are a smuggling attempt whichever comes first
+        if(content_length.has_value() && transfer_encoding)
+            throw htpp::HttpError{400, "Bad Request"};
+        if(transfer_encoding){
+            chunked = true;
+            body_complete = false;
+        }else if(content_length.has_value()){
+            body_remaining = *content_length;
+            body_complete = *content_length == 0;
+        }
+        if(body_complete)
+            expect_continue = false;
+    }
 
-        constexpr std::string_view handshake{" HTTP/1.1\r\n"};
-        co_await wait_for_count(handshake.size());
-        if(!std::equal(handshake.begin(), handshake.end(), it))
-            throw std::logic_error{"Wrong HTTP version"};
-        it += handshake.size();
+    static std::size_t parse_content_length(std::string_view value){
+        std::size_t length;
+        auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), length);
+        if(ec != std::errc{} || end != value.data() + value.size())
+            throw htpp::HttpError{400, "Bad Request"};
+        return length;
+    }
 
-        co_return htpp::Request{type, url, param};
+    // Reads more request bytes without growing the buffer, growing would invalidate the request views
+    asio::awaitable<void> receive_body(){
+        if(filled == buffer.size())
+            compact();
+        if(filled == buffer.size())
+            throw htpp::HttpError{413, "Content Too Large"};
+        expires_after(request_timeout);
+        co_await receive_some();
+        cancel_deadline();
     }
 
-    asio::awaitable<std::string_view> receive_header_value(){
-        auto start = it;
-        co_await find_first_of("\r\n");
-        auto str = std::string_view{start, it};
-        it += *it == '\r' ? 2 : 1;
-        co_return str;
-    };
+    // Drops body bytes already handed out, keeping the head and anything not yet consumed
+    void compact(){
+        if(consumed == head_size)
+            return;
+        std::memmove(buffer.data() + head_size, buffer.data() + consumed, filled - consumed);
+        filled -= consumed - head_size;
+        consumed = head_size;
+    }
 
-    asio::awaitable<void> receive_headers(){
-        connection_keepalive = std::time(nullptr) + keepalive_timeout;
+    asio::awaitable<std::string_view> receive_line(){
         while(true){
-            auto key_start = it;
-            co_await find_first_of(":\r\n");
-            auto key = std::string_view{key_start, it};
-            if(*it == ':'){
-                it += 2; // Skip : and whitespace, not entirely robust as whitespace is optional
-                if(key == "Connection"){
-                    auto value = co_await receive_header_value();
-                    if(value == "close"){
-                        connection_keepalive = std::numeric_limits<std::time_t>::min();
-                    }
-                }
-            }else{
-                it += *it == '\r'? 2 : 1; // Skip past final endline
-                co_return;
+            std::string_view data{buffer.data() + consumed, filled - consumed};
+            auto pos = data.find("\r\n");
+            if(pos != std::string_view::npos){
+                consumed += pos + 2;
+                co_return data.substr(0, pos);
             }
+            co_await receive_body();
         }
     }
 
+    asio::awaitable<void> next_chunk(){
+        if(!first_chunk){
+            auto separator = co_await receive_line();
+            if(!separator.empty())
+                throw htpp::HttpError{400, "Bad Request"};
+        }
+        first_chunk = false;
+
+        auto line = co_await receive_line();
+        std::size_t size;
+        auto [end, ec] = std::from_chars(line.data(), line.data() + line.size(), size, 16);
+        if(ec != std::errc{} || (end != line.data() + line.size() && *end != ';'))
+            throw htpp::HttpError{400, "Bad Request"};
+        body_remaining = size;
+        if(size == 0){
+            for(auto trailer = co_await receive_line(); !trailer.empty(); trailer = co_await receive_line()){} // Trailers are ignored
+            body_complete = true;
+        }
+    }
+
+    // The client waits for this before sending a body it announced with Expect: 100-continue
+    asio::awaitable<void> send_continue(){
+        if(!expect_continue)
+            co_return;
+        expect_continue = false;
+        response_buffer << "HTTP/1.1 100 Continue\r\n\r\n";
+        co_await write_buffered();
+    }
+
+    [[nodiscard]] asio::awaitable<std::string_view> read_body() override {
+        if(body_complete)
+            co_return std::string_view{};
+        co_await send_continue();
+        compact();
+        if(chunked && body_remaining == 0){
+            co_await next_chunk();
+            if(body_complete)
+                co_return std::string_view{};
+        }
+        if(filled == consumed)
+            co_await receive_body();
+        auto count = std::min(filled - consumed, body_remaining);
+        std::string_view piece{buffer.data() + consumed, count};
+        consumed += count;
+        body_remaining -= count;
+        if(!chunked && body_remaining == 0)
+            body_complete = true;
+        co_return piece;
+    }
+
+    [[nodiscard]] asio::awaitable<std::string_view> body() override {
+        if(!chunked && consumed == head_size && head_size + body_remaining <= buffer.size()){
+            // Fits behind the head, read it in place
+            co_await send_continue();
+            while(filled < head_size + body_remaining)
+                co_await receive_body();
+            std::string_view view{buffer.data() + head_size, body_remaining};
+            consumed += body_remaining;
+            body_remaining = 0;
+            body_complete = true;
+            co_return view;
+        }
+        body_storage.clear();
+        for(auto piece = co_await read_body(); !piece.empty(); piece = co_await read_body()){
+            if(body_storage.size() + piece.size() > max_body_size)
+                throw htpp::HttpError{413, "Content Too Large"};
+            body_storage.append(piece);
+        }
+        co_return std::string_view{body_storage};
+    }
+
+    // Skips whatever the handler left unread so the next request starts at the right byte
+    asio::awaitable<void> discard_body(){
+        if(body_complete)
+            co_return;
+        if(expect_continue){ // The client never got the go ahead, so the body is still coming
+            keep_alive = false;
+            co_return;
+        }
+        std::size_t discarded = 0;
+        for(auto piece = co_await read_body(); !piece.empty(); piece = co_await read_body()){
+            discarded += piece.size();
+            if(discarded > max_body_size)
+                throw std::length_error{"Refusing to drain a large unread body"};
+        }
+    }
+
+    // The answer to the current request, bytes still held back for coalescing count as sent
+    htpp::ResponseInfo response_info() const {
+        auto duration = timed ? std::chrono::steady_clock::now() - request_start : std::chrono::steady_clock::duration{};
+        return {response_status, bytes_sent + response_buffer.size() - response_start, duration};
+    }
+
+    void record_request(const htpp::ResponseInfo& info){
+        if(metrics && info.status != 0)
+            htpp::Metrics::request(route_label.empty() ? "unmatched" : route_label, info.status, info.duration);
+    }
+
+    // Drops the handled request, bytes of pipelined requests are kept for the next parse
+    void finish_request(){
+        filled -= consumed;
+        if(filled == 0)
+            buffer.release();
+        else
+            std::memmove(buffer.data(), buffer.data() + consumed, filled);
+        consumed = 0;
+        head_size = 0;
+        if(body_storage.capacity() > BufferPool::block_size)
+            body_storage = std::string{};
+    }
+
+    bool more_requests_buffered() const {
+        return body_complete && std::string_view{buffer.data() + consumed, filled - consumed}.find("\r\n\r\n") != std::string_view::npos;
+    }
+
     asio::awaitable<void> close(){
-        return connection.close();
+        expires_after(request_timeout); // Bound the TLS shutdown
+        co_await connection.close();
+        cancel_deadline();
     }
     
     void default_headers() {
-        response_buffer << "Server: HTPP/" << HTPP_VERSION << "\r\n";
-        auto timestamp = time(nullptr);
-        tm utc; gmtime_r(&timestamp, &utc);
-        response_buffer << "Date: " << weekday(utc) << ", " << Fmt2Int{utc.tm_mday} << ' ' << month(utc) << ' ' << (utc.tm_year + 1900) << ' ' << Fmt2Int{utc.tm_hour} << ':' << Fmt2Int{utc.tm_min} << ':' << Fmt2Int{utc.tm_sec} << " GMT\r\n";
-        if(connection_keepalive > std::numeric_limits<std::time_t>::min()){
-            response_buffer << "Connection: keep-alive\r\n";
-            response_buffer << "Keep-Alive: timeout=" << keepalive_timeout << ", max=1000\r\n";
-        }else{
-            response_buffer << "Connection: close\r\n";
-        }
+        static_assert(keepalive_timeout == std::chrono::seconds(30), "Keep-Alive header is precomputed");
+        response_buffer << DateCache::headers();
+        if(expect_continue && !body_complete)
+            keep_alive = false; // The client never got 100 Continue, discard_body can't skip a body that may not come
+        constexpr std::string_view keep_alive_headers{"Connection: keep-alive\r\nKeep-Alive: timeout=30, max=1000\r\n"};
+        constexpr std::string_view close_headers{"Connection: close\r\n"};
+        response_buffer << (keep_alive ? keep_alive_headers : close_headers);
     }
 
+    // Responses to pipelined requests are held back and leave in one write with the last of the batch
     [[nodiscard]] asio::awaitable<void> send_response() {
-        co_await connection.write(asio::buffer(response_buffer.view()));
-        response_buffer.rdbuf()->pubseekpos(0);
+        responded = true;
+        if(keep_alive && more_requests_buffered() && response_buffer.size() < max_coalesced_response)
+            co_return;
+        co_await write_buffered();
+    }
+
+    [[nodiscard]] asio::awaitable<void> flush() override {
+        responded = true;
+        return write_buffered();
+    }
+
+    // An error status can only be sent while nothing of the regular response has gone out
+    bool can_send_error() {
+        return !responded && connection.is_open();
+    }
+
+    [[nodiscard]] asio::awaitable<void> write_buffered() {
+        gathered.clear();
+        response_buffer.gather(gathered);
+        write_expires_after(write_timeout);
+        auto written = co_await connection.write(gathered);
+        cancel_deadline();
+        bytes_sent += written;
+        if(metrics)
+            htpp::Metrics::sent(written);
+        response_buffer.clear();
+        retained.clear();
+    }
+
+    // Cached bytes are borrowed, the entry is retained until they have been written
+    [[nodiscard]] asio::awaitable<void> send_cached(std::shared_ptr<const htpp::CachedFile> file) {
+        response_status = 200;
+        response_buffer << "HTTP/1.1 200 \r\n";
+        default_headers();
+        const auto& variant = file->select(accepted_encodings);
+        response_buffer.borrow(variant.headers);
+        response_buffer.borrow(variant.body);
+        retained.push_back(std::move(file));
+        return send_response();
+    }
+
+    [[nodiscard]] asio::awaitable<void> send_file(htpp::FileResponse file) override {
+        responded = true;
+        gathered.clear();
+        response_buffer.gather(gathered);
+        write_expires_after(write_timeout);
+        co_await connection.write_file(gathered, file.native_handle(), file.content_size());
+        cancel_deadline();
+        auto written = asio::buffer_size(gathered) + file.content_size();
+        bytes_sent += written;
+        if(metrics)
+            htpp::Metrics::sent(written);
+        response_buffer.clear();
+        retained.clear();
     }
 };
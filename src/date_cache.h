@@ -0,0 +1,84 @@
+#pragma once
+#include "utilites.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <mutex>
+#include <string_view>
+#include <asio.hpp>
+
+#ifndef HTPP_VERSION
+#define HTPP_VERSION "unversioned"
+#endif
+
+// Pre-formatted Server and Date header lines, rebuilt once a second so responses only copy them.
+// Readers never lock, a reader would have to stall for slot_count seconds mid copy to observe a slot being rewritten.
+class DateCache{
+    struct Slot{
+        std::array<char, 128> data;
+        std::size_t size;
+    };
+    static constexpr std::size_t slot_count = 8;
+    static inline std::array<Slot, slot_count> slots{};
+    static inline std::atomic<std::size_t> current{0};
+    static inline std::atomic<bool> ready{false};
+    static inline std::mutex writer;
+
+    static char* format_two(char* out, int value){
+        out[0] = static_cast<char>('0' + value / 10);
+        out[1] = static_cast<char>('0' + value % 10);
+        return out + 2;
+    }
+
+    static char* copy(char* out, std::string_view str){
+        return std::copy(str.begin(), str.end(), out);
+    }
+
+public:
+    static void refresh(){
+        auto guard = std::lock_guard{writer};
+        auto timestamp = std::time(nullptr);
+        tm utc; gmtime_r(&timestamp, &utc);
+
+        auto next = (current.load(std::memory_order_relaxed) + 1) % slot_count;
+        auto& slot = slots[next];
+        char* out = copy(slot.data.data(), "Server: HTPP/" HTPP_VERSION "\r\nDate: ");
+        out = copy(out, weekday(utc));
+        out = copy(out, ", ");
+        out = format_two(out, utc.tm_mday);
+        *out++ = ' ';
+        out = copy(out, month(utc));
+        *out++ = ' ';
+        out = std::to_chars(out, out + 8, utc.tm_year + 1900).ptr;
+        *out++ = ' ';
+        out = format_two(out, utc.tm_hour);
+        *out++ = ':';
+        out = format_two(out, utc.tm_min);
+        *out++ = ':';
+        out = format_two(out, utc.tm_sec);
+        out = copy(out, " GMT\r\n");
+        slot.size = static_cast<std::size_t>(out - slot.data.data());
+
+        current.store(next, std::memory_order_release);
+        ready.store(true, std::memory_order_release);
+    }
+
+    static std::string_view headers(){
+        if(!ready.load(std::memory_order_acquire))
+            refresh();
+        const auto& slot = slots[current.load(std::memory_order_acquire)];
+        return {slot.data.data(), slot.size};
+    }
+
+    // Refreshes on every wall clock second for as long as the context runs
+    static asio::awaitable<void> run(){
+        asio::system_timer timer{co_await asio::this_coro::executor};
+        while(true){
+            refresh();
+            timer.expires_at(std::chrono::floor<std::chrono::seconds>(std::chrono::system_clock::now()) + std::chrono::seconds(1));
+            co_await timer.async_wait(asio::use_awaitable);
+        }
+    }
+};
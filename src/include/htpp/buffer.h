@@ -0,0 +1,171 @@
+#pragma once
+#include <algorithm>
+#include <charconv>
+#include <concepts>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace htpp{
+    // Reusable byte arena responses are built in, written out as a list of segments with one gathered write.
+    // Borrowed views are written in place without copying and must stay valid until the connection has written them.
+    class ResponseBuffer{
+        struct Segment{
+            const char* borrowed; // nullptr when the bytes live in the arena
+            std::size_t offset;
+            std::size_t size;
+        };
+
+        std::unique_ptr<char[]> arena;
+        std::size_t capacity{0};
+        std::size_t used{0};
+        std::vector<Segment> segments;
+        bool sealed{true}; // Next append has to start a new segment
+
+        void reserve(std::size_t more){
+            if(used + more <= capacity)
+                return;
+            auto new_capacity = std::max(capacity * 2, std::max<std::size_t>(used + more, 1024));
+            auto bigger = std::make_unique_for_overwrite<char[]>(new_capacity);
+            if(used > 0)
+                std::memcpy(bigger.get(), arena.get(), used);
+            arena = std::move(bigger);
+            capacity = new_capacity;
+        }
+
+        // Space for exactly `count` more bytes at the end of the arena
+        char* extend(std::size_t count){
+            reserve(count);
+            if(sealed){
+                segments.push_back({nullptr, used, 0});
+                sealed = false;
+            }
+            char* out = arena.get() + used;
+            used += count;
+            segments.back().size += count;
+            return out;
+        }
+
+        void shrink(std::size_t count){
+            used -= count;
+            segments.back().size -= count;
+        }
+
+    public:
+        ResponseBuffer() = default;
+        ResponseBuffer(const ResponseBuffer&) = delete;
+        ResponseBuffer& operator=(const ResponseBuffer&) = delete;
+        ResponseBuffer(ResponseBuffer&&) noexcept = default;
+        ResponseBuffer& operator=(ResponseBuffer&&) noexcept = default;
+
+        void append(std::string_view str){
+            if(!str.empty())
+                std::memcpy(extend(str.size()), str.data(), str.size());
+        }
+
+        void append(char c){
+            *extend(1) = c;
+        }
+
+        template<typename T> requires (std::integral<T> || std::floating_point<T>) && (!std::same_as<T, char>) && (!std::same_as<T, bool>)
+        void append(T value){
+            constexpr std::size_t max_length = 32;
+            char* out = extend(max_length);
+            auto [end, ec] = std::to_chars(out, out + max_length, value);
+            shrink(max_length - static_cast<std::size_t>(end - out));
+        }
+
+        void append(bool value){
+            append(value ? std::string_view{"true"} : std::string_view{"false"});
+        }
+
+        // Writes `count` bytes through the callback directly into the arena, returning how many it used
+        template<typename F>
+        void append_with(std::size_t count, F&& write){
+            char* out = extend(count);
+            shrink(count - write(out));
+        }
+
+        void borrow(std::string_view str){
+            if(str.empty())
+                return;
+            segments.push_back({str.data(), 0, str.size()});
+            sealed = true;
+        }
+
+        std::size_t size() const {
+            std::size_t total = 0;
+            for(const auto& segment : segments)
+                total += segment.size;
+            return total;
+        }
+
+        bool empty() const { return segments.empty(); }
+
+        // Starts a new segment, the returned position can later be used to reorder or drop what follows it
+        std::size_t checkpoint(){
+            sealed = true;
+            return segments.size();
+        }
+
+        std::size_t size_since(std::size_t position) const {
+            std::size_t total = 0;
+            for(auto i = position; i < segments.size(); i++)
+                total += segments[i].size;
+            return total;
+        }
+
+        std::string copy_since(std::size_t position) const {
+            std::string out;
+            out.reserve(size_since(position));
+            for(auto i = position; i < segments.size(); i++)
+                out.append(view(segments[i]));
+            return out;
+        }
+
+        void truncate(std::size_t position){
+            segments.resize(std::min(position, segments.size()));
+            used = 0;
+            for(const auto& segment : segments)
+                if(segment.borrowed == nullptr)
+                    used = std::max(used, segment.offset + segment.size);
+            sealed = true;
+        }
+
+        // Moves everything appended after `tail` so it starts at `position`
+        void move_before(std::size_t position, std::size_t tail){
+            std::rotate(segments.begin() + static_cast<std::ptrdiff_t>(position), segments.begin() + static_cast<std::ptrdiff_t>(tail), segments.end());
+            sealed = true;
+        }
+
+        template<typename Buffer>
+        void gather(std::vector<Buffer>& out) const {
+            for(const auto& segment : segments)
+                out.emplace_back(view(segment).data(), segment.size);
+        }
+
+        std::string str() const {
+            return copy_since(0);
+        }
+
+        void clear(){
+            used = 0;
+            segments.clear();
+            sealed = true;
+        }
+
+        ResponseBuffer& operator<<(std::string_view str){ append(str); return *this; }
+        ResponseBuffer& operator<<(const char* str){ append(std::string_view{str}); return *this; }
+        ResponseBuffer& operator<<(const std::string& str){ append(std::string_view{str}); return *this; }
+        ResponseBuffer& operator<<(char c){ append(c); return *this; }
+        template<typename T> requires std::integral<T> || std::floating_point<T>
+        ResponseBuffer& operator<<(T value){ append(value); return *this; }
+
+    private:
+        std::string_view view(const Segment& segment) const {
+            return {segment.borrowed != nullptr ? segment.borrowed : arena.get() + segment.offset, segment.size};
+        }
+    };
+}
@@ -1,10 +1,28 @@
 #pragma once
+#include <htpp/buffer.h>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
 #include <string>
 #include <string_view>
 #include <optional>
+#include <stdexcept>
 #include <utility>
 
 namespace htpp{
+    template<size_t N>
+    struct StringLiteral {
+        constexpr StringLiteral(const char (&str)[N]) {
+            std::copy_n(str, N, value);
+        }
+        constexpr operator const char*() const {
+            return value;
+        }
+
+        char value[N];
+    };
+
     enum class RequestType{
         GET,
         HEAD,
@@ -88,11 +106,35 @@ namespace htpp{
         ApplicationOctetStream // Default, provides some safety
     };
 
+    // Bit flags so a set of accepted encodings fits in one value
+    enum class Encoding : uint8_t{
+        Identity = 0,
+        Gzip = 1,
+        Brotli = 2
+    };
+
+    constexpr Encoding operator|(Encoding a, Encoding b){
+        return static_cast<Encoding>(static_cast<uint8_t>(a) | static_cast<uint8_t>(b));
+    }
+
+    constexpr bool has(Encoding set, Encoding encoding){
+        return (static_cast<uint8_t>(set) & static_cast<uint8_t>(encoding)) != 0;
+    }
+
+    inline std::string_view to_str(Encoding encoding){
+        switch(encoding){
+            case Encoding::Gzip: return "gzip";
+            case Encoding::Brotli: return "br";
+            case Encoding::Identity: return "identity";
+        }
+        return "identity";
+    }
+
     ContentType from_file_extension(std::string_view extension);
     std::string_view to_str(ContentType type);
 
     template<typename T>
-    concept ContentConcept = requires (T t, std::stringstream s) {
+    concept ContentConcept = requires (T t, ResponseBuffer s) {
         {t.print_content(s)};
         {t.content_type()} -> std::same_as<htpp::ContentType>;
     };
@@ -103,14 +145,20 @@ namespace htpp{
     };
 
     template<typename T>
-    concept ResponseConcept = requires (const T t, std::stringstream s) {
+    concept ResponseConcept = requires (const T t, ResponseBuffer s) {
         {t.response_code()} -> std::same_as<uint16_t>;
         {t.header_line(s)};
     };
 
+    // Optional, responses with headers of their own write them as full lines
+    template<typename T>
+    concept HeadersConcept = requires (const T t, ResponseBuffer s) {
+        {t.headers(s)};
+    };
+
     struct OkResponse{
         uint16_t response_code() const { return 200; }
-        void header_line(std::stringstream&) const {}
+        void header_line(ResponseBuffer&) const {}
     };
     static_assert(ResponseConcept<OkResponse>);
 
@@ -119,14 +167,158 @@ namespace htpp{
     public:
         explicit Response(uint16_t code): code{code} {}
         uint16_t response_code() const { return code; }
-        void header_line(std::stringstream&) const {}
+        void header_line(ResponseBuffer&) const {}
     };
     static_assert(ResponseConcept<Response>);
 
+    struct PathParam{
+        std::string_view name;
+        std::string_view value;
+    };
+
+    // Headers the server knows by id, anything else is Header::Other and found by name
+    enum class Header : uint8_t{
+        Host,
+        Connection,
+        ContentLength,
+        ContentType,
+        TransferEncoding,
+        AcceptEncoding,
+        Accept,
+        Expect,
+        UserAgent,
+        Cookie,
+        Authorization,
+        Referer,
+        Origin,
+        Other
+    };
+
+    constexpr char ascii_lower(char c){
+        return c >= 'A' && c <= 'Z' ? static_cast<char>(c | 0x20) : c;
+    }
+
+    constexpr bool iequals_ascii(std::string_view a, std::string_view b){
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char l, char r){
+            return ascii_lower(l) == ascii_lower(r);
+        });
+    }
+
+    // Picks candidates by length before comparing against the lower case name eight bytes at a time, so most
+    // names cost one or two word compares. Folding with | 0x20 is exact here since the known names are letters
+    // and '-', and tokenize_headers only lets through names made of tchars, so no CR folds onto '-'.
+    inline Header header_id(std::string_view name){
+        using enum Header;
+        auto is = [name](std::string_view known){
+            std::size_t i = 0;
+            for(; i + 8 <= known.size(); i += 8){
+                uint64_t word, expected;
+                std::memcpy(&word, name.data() + i, 8);
+                std::memcpy(&expected, known.data() + i, 8);
+                if((word | 0x2020202020202020) != expected)
+                    return false;
+            }
+            for(; i < known.size(); i++)
+                if(static_cast<char>(name[i] | 0x20) != known[i])
+                    return false;
+            return true;
+        };
+        switch(name.size()){
+            case 4: return is("host") ? Host : Other;
+            case 6:
+                if(is("accept")) return Accept;
+                if(is("expect")) return Expect;
+                if(is("cookie")) return Cookie;
+                if(is("origin")) return Origin;
+                return Other;
+            case 7: return is("referer") ? Referer : Other;
+            case 10:
+                if(is("connection")) return Connection;
+                if(is("user-agent")) return UserAgent;
+                return Other;
+            case 12: return is("content-type") ? ContentType : Other;
+            case 13: return is("authorization") ? Authorization : Other;
+            case 14: return is("content-length") ? ContentLength : Other;
+            case 15: return is("accept-encoding") ? AcceptEncoding : Other;
+            case 17: return is("transfer-encoding") ? TransferEncoding : Other;
+        }
+        return Other;
+    }
+
+    struct HeaderField{
+        std::string_view name;
+        std::string_view value;
+        Header id;
+    };
+
+    // Fixed capacity table of views into the request buffer, nothing is allocated per request
+    class Headers{
+    public:
+        static constexpr std::size_t capacity = 64;
+    private:
+        static constexpr uint8_t missing = 0xFF;
+        std::array<HeaderField, capacity> fields;
+        std::array<uint8_t, static_cast<std::size_t>(Header::Other)> first; // Index of the first field per known id
+        std::size_t count{0};
+    public:
+        Headers(){ clear(); }
+
+        void clear(){
+            count = 0;
+            first.fill(missing);
+        }
+
+        // Returns false when the table is full
+        bool add(std::string_view name, std::string_view value, Header id){
+            if(count == capacity)
+                return false;
+            if(id != Header::Other && first[static_cast<std::size_t>(id)] == missing)
+                first[static_cast<std::size_t>(id)] = static_cast<uint8_t>(count);
+            fields[count++] = {name, value, id};
+            return true;
+        }
+
+        std::optional<std::string_view> get(Header id) const {
+            if(id == Header::Other || first[static_cast<std::size_t>(id)] == missing)
+                return std::nullopt;
+            return fields[first[static_cast<std::size_t>(id)]].value;
+        }
+
+        std::optional<std::string_view> get(std::string_view name) const {
+            if(auto id = header_id(name); id != Header::Other)
+                return get(id);
+            for(const auto& field : *this)
+                if(iequals_ascii(field.name, name))
+                    return field.value;
+            return std::nullopt;
+        }
+
+        bool contains(Header id) const { return get(id).has_value(); }
+        std::size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        const HeaderField* begin() const { return fields.data(); }
+        const HeaderField* end() const { return fields.data() + count; }
+    };
+
+    enum class Version : uint8_t{
+        Http10,
+        Http11
+    };
+
     struct Request{
         RequestType type;
         std::string_view url;
         std::string_view param;
+        Version version;
+        Headers headers;
+    };
+
+    // Thrown for requests the server answers with an error status and then closes the connection
+    class HttpError : public std::runtime_error{
+        uint16_t code;
+    public:
+        HttpError(uint16_t code, const char* reason): std::runtime_error{reason}, code{code} {}
+        uint16_t status() const { return code; }
     };
 
     inline std::string_view to_str(RequestType type){
@@ -141,7 +333,7 @@ namespace htpp{
         case OPTIONS: return "OPTIONS";
         case TRACE: return "TRACE";
         case CONNECT: return "CONNECT";
-        case PATCH: return "OTHER";
+        case PATCH: return "PATCH";
         }
         return "Unknown";
     }
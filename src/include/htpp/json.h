@@ -1,11 +1,25 @@
 #pragma once
-#include <iostream>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
 #include <string_view>
-#include <sstream>
 #include <algorithm>
 #include <ranges>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
 #include "lib.h"
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 //// Example:
 // struct Point{
 //     using json_names = json::key_name<"message">;
@@ -16,21 +30,45 @@
 namespace json{
 
     namespace inner{
-        template<size_t N>
-        struct StringLiteral {
-            constexpr StringLiteral(const char (&str)[N]) {
-                std::copy_n(str, N, value);
-            }
-            constexpr operator const char*() const {
-                return value;
+        using htpp::StringLiteral;
+
+        constexpr bool needs_escape(char c){
+            return static_cast<unsigned char>(c) < 0x20 || c == '"' || c == '\\';
+        }
+
+        // `,"name":` for a member, the first member skips the comma
+        template<StringLiteral name>
+        consteval auto make_member_prefix(){
+            constexpr auto length = sizeof(name.value) - 1;
+            std::array<char, length + 4> out{};
+            out[0] = ',';
+            out[1] = '"';
+            for(std::size_t i = 0; i < length; i++){
+                if(needs_escape(name.value[i]))
+                    throw "json key names must not need escaping";
+                out[i + 2] = name.value[i];
             }
-            
-            char value[N];
-        };
+            out[length + 2] = '"';
+            out[length + 3] = ':';
+            return out;
+        }
+
+        template<StringLiteral name>
+        inline constexpr auto member_prefix = make_member_prefix<name>();
     }
 
+    // Members an object type can have. Objects are taken apart with structured bindings, C++23 can't bind a pack
+    // of members so inner::tie_fields spells out every count up to this one
+    inline constexpr std::size_t max_members = 32;
+
     template<inner::StringLiteral ... names>
     struct key_name {
+        static_assert(sizeof...(names) <= max_members, "json objects can have at most 32 members (json::max_members), nest the rest in a member object");
+
+        static constexpr std::array<std::string_view, sizeof...(names)> prefixes{
+            std::string_view{inner::member_prefix<names>.data(), inner::member_prefix<names>.size()}...
+        };
+
         template<int i>
         consteval static const char* get(){
             return std::vector<const char*>{names...}[i];
@@ -42,86 +80,633 @@ namespace json{
     };
 
     namespace inner{
+        // First byte in [it, end) that has to be escaped inside a JSON string, or end. Strings are mostly clean,
+        // so whole vector windows are checked for control bytes, quotes and backslashes at once.
+        inline const char* find_escape(const char* it, const char* end){
+#if defined(__AVX2__)
+            for(; end - it >= 32; it += 32){
+                auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(it));
+                auto control = _mm256_cmpeq_epi8(_mm256_max_epu8(block, _mm256_set1_epi8(0x1f)), _mm256_set1_epi8(0x1f));
+                auto quote = _mm256_cmpeq_epi8(block, _mm256_set1_epi8('"'));
+                auto backslash = _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\\'));
+                auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(control, _mm256_or_si256(quote, backslash))));
+                if(mask != 0)
+                    return it + std::countr_zero(mask);
+            }
+#endif
+#if defined(__SSE2__)
+            for(; end - it >= 16; it += 16){
+                auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(it));
+                auto control = _mm_cmpeq_epi8(_mm_max_epu8(block, _mm_set1_epi8(0x1f)), _mm_set1_epi8(0x1f));
+                auto quote = _mm_cmpeq_epi8(block, _mm_set1_epi8('"'));
+                auto backslash = _mm_cmpeq_epi8(block, _mm_set1_epi8('\\'));
+                auto mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(control, _mm_or_si128(quote, backslash))));
+                if(mask != 0)
+                    return it + std::countr_zero(mask);
+            }
+#endif
+            for(; it != end; it++)
+                if(needs_escape(*it))
+                    return it;
+            return end;
+        }
+
+        // Escapes str into out, which has room for six bytes per input byte. Clean runs are copied whole.
+        inline std::size_t escape_into(char* out, std::string_view str){
+            constexpr std::string_view hex{"0123456789abcdef"};
+            char* start = out;
+            const char* it = str.data();
+            const char* end = it + str.size();
+            while(it != end){
+                auto found = find_escape(it, end);
+                std::memcpy(out, it, static_cast<std::size_t>(found - it));
+                out += found - it;
+                if(found == end)
+                    break;
+                *out++ = '\\';
+                switch(*found){
+                    case '"': *out++ = '"'; break;
+                    case '\\': *out++ = '\\'; break;
+                    case '\n': *out++ = 'n'; break;
+                    case '\r': *out++ = 'r'; break;
+                    case '\t': *out++ = 't'; break;
+                    default: {
+                        auto byte = static_cast<unsigned char>(*found);
+                        std::memcpy(out, "u00", 3);
+                        out[3] = hex[byte >> 4];
+                        out[4] = hex[byte & 0xf];
+                        out += 5;
+                    }
+                }
+                it = found + 1;
+            }
+            return static_cast<std::size_t>(out - start);
+        }
+
+        // Long strings go through in slices so the worst case reservation stays small
+        inline void write_string(htpp::ResponseBuffer& s, std::string_view str){
+            constexpr std::size_t slice = 4096;
+            s << '"';
+            while(!str.empty()){
+                auto part = str.substr(0, slice);
+                s.append_with(part.size() * 6, [part](char* out){ return escape_into(out, part); });
+                str.remove_prefix(part.size());
+            }
+            s << '"';
+        }
+
+        template<typename T, template<typename...> typename Template>
+        constexpr bool is_specialization = false;
+        template<template<typename...> typename Template, typename ... Args>
+        constexpr bool is_specialization<Template<Args...>, Template> = true;
 
         template<typename T>
-        constexpr void serialize(std::stringstream& s, const T& object);
+        concept Object = requires { typename T::json_names; };
 
         template<typename T>
-        void serialize_field(std::stringstream& s, const T& field){
-            if constexpr(std::is_integral_v<T> || std::is_floating_point_v<T>)
-                s << field;
-            else if constexpr(std::is_convertible_v<T, std::string_view>){
-                s << '"' << std::string_view{field} << '"';
-            }else{
-                serialize(s, field);
-            }
+        concept Map = std::ranges::range<T> && requires { typename T::key_type; typename T::mapped_type; };
+
+        // References to the members of an aggregate, const when the aggregate is. C++23 can't bind a pack of members, so each count is spelled out.
+        template<std::size_t count, typename T>
+        constexpr auto tie_fields(T& object){
+            static_assert(count <= max_members, "json objects can have at most 32 members (json::max_members)");
+#define HTPP_JSON_TIE(n, ...) if constexpr(count == n){ auto& [__VA_ARGS__] = object; return std::tie(__VA_ARGS__); } else
+            HTPP_JSON_TIE(1, f0)
+            HTPP_JSON_TIE(2, f0, f1)
+            HTPP_JSON_TIE(3, f0, f1, f2)
+            HTPP_JSON_TIE(4, f0, f1, f2, f3)
+            HTPP_JSON_TIE(5, f0, f1, f2, f3, f4)
+            HTPP_JSON_TIE(6, f0, f1, f2, f3, f4, f5)
+            HTPP_JSON_TIE(7, f0, f1, f2, f3, f4, f5, f6)
+            HTPP_JSON_TIE(8, f0, f1, f2, f3, f4, f5, f6, f7)
+            HTPP_JSON_TIE(9, f0, f1, f2, f3, f4, f5, f6, f7, f8)
+            HTPP_JSON_TIE(10, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9)
+            HTPP_JSON_TIE(11, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10)
+            HTPP_JSON_TIE(12, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11)
+            HTPP_JSON_TIE(13, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12)
+            HTPP_JSON_TIE(14, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13)
+            HTPP_JSON_TIE(15, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14)
+            HTPP_JSON_TIE(16, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15)
+            HTPP_JSON_TIE(17, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16)
+            HTPP_JSON_TIE(18, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17)
+            HTPP_JSON_TIE(19, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18)
+            HTPP_JSON_TIE(20, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18, f19)
+            HTPP_JSON_TIE(21, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18, f19, f20)
+            HTPP_JSON_TIE(22, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18, f19, f20, f21)
+            HTPP_JSON_TIE(23, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18, f19, f20, f21, f22)
+            HTPP_JSON_TIE(24, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18, f19, f20, f21, f22, f23)
+            HTPP_JSON_TIE(25, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18, f19, f20, f21, f22, f23, f24)
+            HTPP_JSON_TIE(26, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25)
+            HTPP_JSON_TIE(27, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26)
+            HTPP_JSON_TIE(28, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27)
+            HTPP_JSON_TIE(29, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28)
+            HTPP_JSON_TIE(30, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29)
+            HTPP_JSON_TIE(31, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29, f30)
+            HTPP_JSON_TIE(32, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18, f19, f20, f21, f22, f23, f24, f25, f26, f27, f28, f29, f30, f31)
+            return std::tuple<>{};
+#undef HTPP_JSON_TIE
         }
 
         template<typename T>
-        constexpr void serialize(std::stringstream& s, const T& object){
-            constexpr auto size = T::json_names::count();
+        void serialize(htpp::ResponseBuffer& s, const T& value);
+
+        template<typename T, std::size_t ... i>
+        void serialize_object(htpp::ResponseBuffer& s, const T& object, std::index_sequence<i...>){
+            auto fields = tie_fields<sizeof...(i)>(object);
             s << '{';
-            if constexpr(size == 1){
-                const auto& [v1] = object;
-                s << '"' << T::json_names::template get<0>() << "\":"; serialize_field(s, v1);
-            }else if constexpr( size == 2){
-                const auto& [v1, v2] = object;
-                s << '"' << T::json_names::template get<0>() << "\":"; serialize_field(s, v1); s << ',';
-                s << '"' << T::json_names::template get<1>() << "\":"; serialize_field(s, v2);
-            }else if constexpr( size == 3){
-                const auto& [v1, v2, v3] = object;
-                s << '"' << T::json_names::template get<0>() << "\":"; serialize_field(s, v1); s << ',';
-                s << '"' << T::json_names::template get<1>() << "\":"; serialize_field(s, v2); s << ',';
-                s << '"' << T::json_names::template get<2>() << "\":"; serialize_field(s, v3);
-            }else if constexpr( size == 4){
-                const auto& [v1, v2, v3, v4] = object;
-                s << '"' << T::json_names::template get<0>() << "\":"; serialize_field(s, v1); s << ',';
-                s << '"' << T::json_names::template get<1>() << "\":"; serialize_field(s, v2); s << ',';
-                s << '"' << T::json_names::template get<2>() << "\":"; serialize_field(s, v3); s << ',';
-                s << '"' << T::json_names::template get<3>() << "\":"; serialize_field(s, v4);
-            }else if constexpr( size == 5){
-                const auto& [v1, v2, v3, v4, v5] = object;
-                s << '"' << T::json_names::template get<0>() << "\":"; serialize_field(s, v1); s << ',';
-                s << '"' << T::json_names::template get<1>() << "\":"; serialize_field(s, v2); s << ',';
-                s << '"' << T::json_names::template get<2>() << "\":"; serialize_field(s, v3); s << ',';
-                s << '"' << T::json_names::template get<3>() << "\":"; serialize_field(s, v4); s << ',';
-                s << '"' << T::json_names::template get<4>() << "\":"; serialize_field(s, v5);
-            }else if constexpr( size == 6){
-                const auto& [v1, v2, v3, v4, v5, v6] = object;
-                s << '"' << T::json_names::template get<0>() << "\":"; serialize_field(s, v1); s << ',';
-                s << '"' << T::json_names::template get<1>() << "\":"; serialize_field(s, v2); s << ',';
-                s << '"' << T::json_names::template get<2>() << "\":"; serialize_field(s, v3); s << ',';
-                s << '"' << T::json_names::template get<3>() << "\":"; serialize_field(s, v4); s << ',';
-                s << '"' << T::json_names::template get<4>() << "\":"; serialize_field(s, v5); s << ',';
-                s << '"' << T::json_names::template get<5>() << "\":"; serialize_field(s, v6);
-            }
-            
+            ((s << T::json_names::prefixes[i].substr(i == 0 ? 1 : 0), serialize(s, std::get<i>(fields))), ...);
             s << '}';
         }
 
-        template<std::ranges::range T>
-        constexpr void serialize(std::stringstream& s, const T& object){
-            s << '[';
-            auto it = std::begin(object);
-            const auto end = std::end(object);
-            if(it != end){
-                serialize_field(s, *it);
-                while(++it != end){
-                    s << ',';
-                    serialize_field(s, *it);
+        template<typename T>
+        void serialize(htpp::ResponseBuffer& s, const T& value){
+            if constexpr(Object<T>){
+                serialize_object(s, value, std::make_index_sequence<T::json_names::count()>{});
+            }else if constexpr(std::is_same_v<T, std::nullptr_t> || std::is_same_v<T, std::nullopt_t> || std::is_same_v<T, std::monostate>){
+                s << "null";
+            }else if constexpr(std::is_same_v<T, char>){
+                write_string(s, std::string_view{&value, 1});
+            }else if constexpr(std::is_integral_v<T>){
+                s << value;
+            }else if constexpr(std::is_floating_point_v<T>){
+                if(std::isfinite(value))
+                    s << value;
+                else
+                    s << "null"; // JSON has no NaN or infinity
+            }else if constexpr(is_specialization<T, std::optional>){
+                if(value)
+                    serialize(s, *value);
+                else
+                    s << "null";
+            }else if constexpr(is_specialization<T, std::variant>){
+                std::visit([&s](const auto& alternative){ serialize(s, alternative); }, value);
+            }else if constexpr(std::is_convertible_v<const T&, std::string_view>){
+                write_string(s, std::string_view{value});
+            }else if constexpr(Map<T>){
+                s << '{';
+                bool first = true;
+                for(const auto& [key, mapped] : value){
+                    if(!first)
+                        s << ',';
+                    first = false;
+                    if constexpr(std::is_convertible_v<const typename T::key_type&, std::string_view>)
+                        write_string(s, std::string_view{key});
+                    else
+                        s << '"' << key << '"'; // Numeric keys
+                    s << ':';
+                    serialize(s, mapped);
+                }
+                s << '}';
+            }else if constexpr(std::ranges::range<T>){
+                s << '[';
+                bool first = true;
+                for(const auto& item : value){
+                    if(!first)
+                        s << ',';
+                    first = false;
+                    serialize(s, item);
                 }
+                s << ']';
+            }else{
+                static_assert(Object<T>, "type has no json representation, add a json_names member");
             }
-            s << ']';
         }
+    }
+
+    // Thrown for malformed JSON, the server answers it with 400 Bad Request
+    class ParseError : public htpp::HttpError{
+    public:
+        ParseError(): htpp::HttpError{400, "Bad Request"} {}
+    };
+
+    namespace inner{
+        constexpr uint32_t key_hash(std::string_view key){
+            uint32_t hash = 2166136261u; // FNV-1a
+            for(char c : key)
+                hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+            return hash;
+        }
+
+        // Open addressed table from key to member index, laid out at compile time with twice as many slots as members
+        template<typename Names>
+        struct KeyTable{
+            static constexpr std::size_t count = Names::count();
+            static constexpr std::size_t size = std::bit_ceil(count * 2);
+
+            static constexpr std::string_view name(std::size_t i){
+                auto prefix = Names::prefixes[i];
+                return prefix.substr(2, prefix.size() - 4);
+            }
+
+            static constexpr auto slots = []{
+                std::array<uint8_t, size> out{}; // Member index + 1, 0 is empty
+                for(std::size_t i = 0; i < count; i++){
+                    auto slot = key_hash(name(i)) & (size - 1);
+                    while(out[slot] != 0)
+                        slot = (slot + 1) & (size - 1);
+                    out[slot] = static_cast<uint8_t>(i + 1);
+                }
+                return out;
+            }();
+
+            // Member index of key, or count when no member has that name
+            static constexpr std::size_t find(std::string_view key){
+                for(auto slot = key_hash(key) & (size - 1); slots[slot] != 0; slot = (slot + 1) & (size - 1))
+                    if(name(slots[slot] - 1u) == key)
+                        return slots[slot] - 1u;
+                return count;
+            }
+        };
 
+        // Cursor over a JSON text, every malformed input throws ParseError
+        class Reader{
+            static constexpr std::size_t max_depth = 64;
+
+            const char* it;
+            const char* end;
+            std::size_t depth{0};
+
+        public:
+            std::string* storage; // Holds unescaped std::string_view members, reserved up front so views into it stay valid
+
+            explicit Reader(std::string_view text, std::string* storage = nullptr): it{text.data()}, end{text.data() + text.size()}, storage{storage} {
+                if(storage){
+                    storage->clear();
+                    storage->reserve(text.size()); // Unescaped text is never longer than its source
+                }
+            }
+
+            [[noreturn]] static void fail(){ throw ParseError{}; }
+
+            void skip_space(){
+                while(it != end && (*it == ' ' || *it == '\n' || *it == '\r' || *it == '\t'))
+                    it++;
+            }
+
+            bool at_end(){
+                skip_space();
+                return it == end;
+            }
+
+            char peek(){
+                skip_space();
+                if(it == end)
+                    fail();
+                return *it;
+            }
+
+            bool consume(char c){
+                if(peek() != c)
+                    return false;
+                it++;
+                return true;
+            }
+
+            void expect(char c){
+                if(!consume(c))
+                    fail();
+            }
+
+            bool consume_word(std::string_view word){
+                skip_space();
+                if(static_cast<std::size_t>(end - it) < word.size() || std::memcmp(it, word.data(), word.size()) != 0)
+                    return false;
+                it += word.size();
+                return true;
+            }
+
+            void enter(){
+                if(++depth > max_depth)
+                    fail();
+            }
+
+            void leave(){ depth--; }
+
+            // Raw contents of the next string, escaped tells whether they still have to be unescaped.
+            // The same vector scan the writer escapes with jumps to the closing quote or next backslash.
+            std::string_view string(bool& escaped){
+                expect('"');
+                auto start = it;
+                escaped = false;
+                while(true){
+                    auto found = find_escape(it, end);
+                    if(found == end || static_cast<unsigned char>(*found) < 0x20)
+                        fail();
+                    if(*found == '"'){
+                        it = found + 1;
+                        return {start, found};
+                    }
+                    if(end - found < 2)
+                        fail();
+                    escaped = true;
+                    it = found + 2; // \uXXXX digits are checked when unescaping
+                }
+            }
+
+            template<typename T>
+            void number(T& out){
+                skip_space();
+                if(it == end || (*it != '-' && (*it < '0' || *it > '9')))
+                    fail(); // from_chars would take inf and nan
+                auto [next, ec] = std::from_chars(it, end, out);
+                if(ec != std::errc{})
+                    fail();
+                it = next;
+            }
+
+            void skip_value(){
+                bool escaped;
+                switch(peek()){
+                    case '"':
+                        string(escaped);
+                        return;
+                    case '{':
+                        it++;
+                        enter();
+                        if(!consume('}')){
+                            do{
+                                string(escaped);
+                                expect(':');
+                                skip_value();
+                            } while(consume(','));
+                            expect('}');
+                        }
+                        leave();
+                        return;
+                    case '[':
+                        it++;
+                        enter();
+                        if(!consume(']')){
+                            do{
+                                skip_value();
+                            } while(consume(','));
+                            expect(']');
+                        }
+                        leave();
+                        return;
+                    default:
+                        if(consume_word("true") || consume_word("false") || consume_word("null"))
+                            return;
+                        double ignored;
+                        number(ignored);
+                }
+            }
+        };
+
+        inline unsigned hex_quad(const char* digits){
+            unsigned value = 0;
+            for(int i = 0; i < 4; i++){
+                auto c = digits[i];
+                value <<= 4;
+                if(c >= '0' && c <= '9')
+                    value |= static_cast<unsigned>(c - '0');
+                else if((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+                    value |= static_cast<unsigned>((c | 0x20) - 'a' + 10);
+                else
+                    Reader::fail();
+            }
+            return value;
+        }
+
+        // Appends the unescaped form of a raw string, \u escapes become UTF-8
+        inline void unescape(std::string& out, std::string_view raw){
+            out.reserve(out.size() + raw.size());
+            for(std::size_t i = 0; i < raw.size(); i++){
+                if(raw[i] != '\\'){
+                    out += raw[i];
+                    continue;
+                }
+                switch(raw[++i]){
+                    case '"': out += '"'; break;
+                    case '\\': out += '\\'; break;
+                    case '/': out += '/'; break;
+                    case 'b': out += '\b'; break;
+                    case 'f': out += '\f'; break;
+                    case 'n': out += '\n'; break;
+                    case 'r': out += '\r'; break;
+                    case 't': out += '\t'; break;
+                    case 'u': {
+                        if(raw.size() - i < 5)
+                            Reader::fail();
+                        auto code = hex_quad(raw.data() + i + 1);
+                        i += 4;
+                        if(code >= 0xd800 && code < 0xdc00){ // High surrogate, the low half has to follow
+                            if(raw.size() - i < 7 || raw[i + 1] != '\\' || raw[i + 2] != 'u')
+                                Reader::fail();
+                            auto low = hex_quad(raw.data() + i + 3);
+                            if(low < 0xdc00 || low >= 0xe000)
+                                Reader::fail();
+                            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                            i += 6;
+                        }else if(code >= 0xdc00 && code < 0xe000){
+                            Reader::fail();
+                        }
+                        if(code < 0x80){
+                            out += static_cast<char>(code);
+                        }else if(code < 0x800){
+                            out += static_cast<char>(0xc0 | (code >> 6));
+                            out += static_cast<char>(0x80 | (code & 0x3f));
+                        }else if(code < 0x10000){
+                            out += static_cast<char>(0xe0 | (code >> 12));
+                            out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+                            out += static_cast<char>(0x80 | (code & 0x3f));
+                        }else{
+                            out += static_cast<char>(0xf0 | (code >> 18));
+                            out += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+                            out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+                            out += static_cast<char>(0x80 | (code & 0x3f));
+                        }
+                        break;
+                    }
+                    default:
+                        Reader::fail();
+                }
+            }
+        }
+
+        template<typename T>
+        concept Sequence = std::ranges::range<T> && requires(T& container) { container.emplace_back(); container.clear(); };
+
+        template<typename T>
+        void parse_value(Reader& reader, T& out);
+
+        template<typename T, std::size_t ... i>
+        void parse_object(Reader& reader, T& object, std::index_sequence<i...>){
+            using Fields = decltype(tie_fields<sizeof...(i)>(object));
+            using Table = KeyTable<typename T::json_names>;
+            static constexpr std::array<void(*)(Reader&, Fields&), sizeof...(i)> members{
+                [](Reader& r, Fields& fields){ parse_value(r, std::get<i>(fields)); }...
+            };
+
+            auto fields = tie_fields<sizeof...(i)>(object);
+            reader.expect('{');
+            reader.enter();
+            if(!reader.consume('}')){
+                do{
+                    bool escaped;
+                    auto key = reader.string(escaped);
+                    std::string unescaped;
+                    if(escaped){
+                        unescape(unescaped, key);
+                        key = unescaped;
+                    }
+                    reader.expect(':');
+                    auto index = Table::find(key);
+                    if(index < Table::count)
+                        members[index](reader, fields);
+                    else
+                        reader.skip_value(); // Unknown keys are ignored
+                } while(reader.consume(','));
+                reader.expect('}');
+            }
+            reader.leave();
+        }
+
+        template<typename T>
+        void parse_value(Reader& reader, T& out){
+            if constexpr(Object<T>){
+                parse_object(reader, out, std::make_index_sequence<T::json_names::count()>{});
+            }else if constexpr(is_specialization<T, std::optional>){
+                if(reader.consume_word("null")){
+                    out.reset();
+                }else{
+                    out.emplace();
+                    parse_value(reader, *out);
+                }
+            }else if constexpr(std::is_same_v<T, bool>){
+                if(reader.consume_word("true"))
+                    out = true;
+                else if(reader.consume_word("false"))
+                    out = false;
+                else
+                    reader.fail();
+            }else if constexpr(std::is_integral_v<T> || std::is_floating_point_v<T>){
+                reader.number(out);
+            }else if constexpr(std::is_same_v<T, std::string_view>){
+                bool escaped;
+                out = reader.string(escaped);
+                if(escaped){
+                    auto start = reader.storage->size();
+                    unescape(*reader.storage, out);
+                    out = std::string_view{*reader.storage}.substr(start);
+                }
+            }else if constexpr(std::is_same_v<T, std::string>){
+                bool escaped;
+                auto raw = reader.string(escaped);
+                out.clear();
+                if(escaped)
+                    unescape(out, raw);
+                else
+                    out.assign(raw);
+            }else if constexpr(Map<T>){
+                out.clear();
+                reader.expect('{');
+                reader.enter();
+                if(!reader.consume('}')){
+                    do{
+                        typename T::key_type key;
+                        if constexpr(std::is_arithmetic_v<typename T::key_type>){ // Numeric keys are written quoted
+                            bool escaped;
+                            auto raw = reader.string(escaped);
+                            auto [next, ec] = std::from_chars(raw.data(), raw.data() + raw.size(), key);
+                            if(escaped || ec != std::errc{} || next != raw.data() + raw.size())
+                                reader.fail();
+                        }else{
+                            parse_value(reader, key);
+                        }
+                        reader.expect(':');
+                        parse_value(reader, out[std::move(key)]);
+                    } while(reader.consume(','));
+                    reader.expect('}');
+                }
+                reader.leave();
+            }else if constexpr(Sequence<T>){
+                out.clear();
+                reader.expect('[');
+                reader.enter();
+                if(!reader.consume(']')){
+                    do{
+                        parse_value(reader, out.emplace_back());
+                    } while(reader.consume(','));
+                    reader.expect(']');
+                }
+                reader.leave();
+            }else{
+                static_assert(Object<T>, "type can't be parsed from json, add a json_names member");
+            }
+        }
+
+        template<typename T>
+        constexpr bool holds_views();
+
+        template<typename T, std::size_t ... i>
+        constexpr bool object_holds_views(std::index_sequence<i...>){
+            using Fields = decltype(tie_fields<sizeof...(i)>(std::declval<T&>()));
+            return (holds_views<std::remove_cvref_t<std::tuple_element_t<i, Fields>>>() || ...);
+        }
+
+        // Whether parsing T can produce a std::string_view that needs storage for its unescaped text
+        template<typename T>
+        constexpr bool holds_views(){
+            if constexpr(std::is_same_v<T, std::string_view>)
+                return true;
+            else if constexpr(Object<T>)
+                return object_holds_views<T>(std::make_index_sequence<T::json_names::count()>{});
+            else if constexpr(is_specialization<T, std::optional>)
+                return holds_views<typename T::value_type>();
+            else if constexpr(Map<T>)
+                return holds_views<typename T::key_type>() || holds_views<typename T::mapped_type>();
+            else if constexpr(Sequence<T>)
+                return holds_views<std::ranges::range_value_t<T>>();
+            else
+                return false;
+        }
+    }
+
+    // Parses a JSON text into T. Only containers and escaped std::string members allocate.
+    template<typename T>
+    T parse(std::string_view text){
+        static_assert(!inner::holds_views<T>(), "std::string_view members need parse(text, storage) to hold escaped strings, or use std::string");
+        T out{};
+        inner::Reader reader{text};
+        inner::parse_value(reader, out);
+        if(!reader.at_end())
+            inner::Reader::fail();
+        return out;
+    }
+
+    // Parses without copying strings: std::string_view members point into text, or into storage when the string
+    // had escapes. Both must outlive the result, storage is overwritten and may not be modified while it is used.
+    template<typename T>
+    T parse(std::string_view text, std::string& storage){
+        T out{};
+        inner::Reader reader{text, &storage};
+        inner::parse_value(reader, out);
+        if(!reader.at_end())
+            inner::Reader::fail();
+        return out;
+    }
+
+    // Writes a range as a JSON array through a chunked response, flushing whenever a chunk fills up
+    template<std::ranges::range T>
+    asio::awaitable<void> stream_array(htpp::ResponseStream& stream, const T& range){
+        stream.buffer() << '[';
+        bool first = true;
+        for(const auto& item : range){
+            if(!first)
+                stream.buffer() << ',';
+            first = false;
+            inner::serialize(stream.buffer(), item);
+            co_await stream.flush_if_full();
+        }
+        stream.buffer() << ']';
     }
 
-    
     template<typename T>
     struct From : public htpp::OkResponse{
         const T& object; // this storage could be problematic
         explicit From(const T& object): object{object} {}
-        void print_content(std::stringstream& s) const {
+        void print_content(htpp::ResponseBuffer& s) const {
             inner::serialize(s, object);
         }
         htpp::ContentType content_type() const { return htpp::ContentType::ApplicationJson; }
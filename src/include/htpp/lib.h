@@ -7,46 +7,208 @@
 #include <memory>
 #include <optional>
 #include <thread>
-#include <unordered_map>
 #include <sstream>
+#include <limits>
+#include <tuple>
+#include <chrono>
 
 namespace htpp{
+    class StaticFileCache;
+    class Router;
+    class AccessLog;
+    class ServerState;
+
     struct WebPoint : Endpoint{
         using Handler = asio::awaitable<void>(*)(Context&, std::string_view);
         Handler function;
     };
 
 
+    // Answers a request from middleware without running its handler, e.g. for auth or rate limiting
+    struct Rejection{
+        uint16_t status;
+        std::string_view message; // Sent as text/plain, must outlive the response
+    };
+
+    // Hooks run in registration order, every hook has an empty default so middleware overrides only what it needs
     class Middleware{
     public:
         virtual ~Middleware() = default;
-        virtual void on_received(const Request& request) = 0;
+        virtual void on_connection_open(const ConnectionInfo&) {}
+        virtual void on_connection_close(const ConnectionInfo&) {}
+        virtual void on_received(const Request&) {}
+        // The first rejection wins, later middleware and the handler are skipped
+        virtual std::optional<Rejection> before_handler(const Context&) { return std::nullopt; }
+        // Runs for every answered request, also those rejected with an error status before or while parsing
+        virtual void after_response(const Context&, const ResponseInfo&) {}
+    };
+
+    // Statically composed middleware, the whole chain costs one virtual call per hook and inlines the members.
+    // Members are plain types implementing any subset of the Middleware hooks without virtual.
+    template<typename... Items>
+    class MiddlewareChain final : public Middleware{
+        std::tuple<Items...> items;
+    public:
+        MiddlewareChain() = default;
+        explicit MiddlewareChain(Items... items): items{std::move(items)...} {}
+
+        void on_connection_open(const ConnectionInfo& info) override {
+            std::apply([&](auto&... item){
+                ([&]{ if constexpr(requires { item.on_connection_open(info); }) item.on_connection_open(info); }(), ...);
+            }, items);
+        }
+
+        void on_connection_close(const ConnectionInfo& info) override {
+            std::apply([&](auto&... item){
+                ([&]{ if constexpr(requires { item.on_connection_close(info); }) item.on_connection_close(info); }(), ...);
+            }, items);
+        }
+
+        void on_received(const Request& request) override {
+            std::apply([&](auto&... item){
+                ([&]{ if constexpr(requires { item.on_received(request); }) item.on_received(request); }(), ...);
+            }, items);
+        }
+
+        std::optional<Rejection> before_handler(const Context& ctx) override {
+            std::optional<Rejection> rejection;
+            std::apply([&](auto&... item){
+                ([&]{
+                    if constexpr(requires { { item.before_handler(ctx) } -> std::same_as<std::optional<Rejection>>; })
+                        rejection = item.before_handler(ctx);
+                    return rejection.has_value();
+                }() || ...);
+            }, items);
+            return rejection;
+        }
+
+        void after_response(const Context& ctx, const ResponseInfo& info) override {
+            std::apply([&](auto&... item){
+                ([&]{ if constexpr(requires { item.after_response(ctx, info); }) item.after_response(ctx, info); }(), ...);
+            }, items);
+        }
+    };
+
+    struct BufferPoolStats{
+        std::size_t allocated;
+        std::size_t reused;
+        std::size_t released;
+        std::size_t grown;
+        std::size_t in_use;
+    };
+
+    // Shared runs every thread on one io_context behind one acceptor. Sharded gives each thread its own io_context
+    // and SO_REUSEPORT acceptor, connections stay on the thread that accepted them and threads never contend.
+    enum class ThreadMode{
+        Shared,
+        Sharded
+    };
+
+    enum class AccessLogFormat{
+        Common,
+        Combined,
+        Json
     };
 
     struct SslConfig{
-        std::string cert_path;
+        std::string cert_path; // PEM, the certificate followed by its intermediates
         std::string private_key;
+        // OpenSSL cipher strings in order of preference, empty keeps OpenSSL's defaults
+        std::string ciphers{"ECDHE+AESGCM:ECDHE+CHACHA20"}; // TLS 1.2
+        std::string ciphersuites; // TLS 1.3
+        bool prefer_server_ciphers{true};
+        std::size_t session_cache_size{20 * 1024}; // Sessions kept for session id resumption, 0 turns the cache off
+        std::chrono::seconds session_lifetime{std::chrono::hours(2)};
+        // Ticket keys are replaced this often and stay valid for decryption one more period, 0 turns tickets off
+        std::chrono::seconds ticket_rotation{std::chrono::hours(12)};
+    };
+
+    // One listening endpoint. Sharded servers bind it once per shard with SO_REUSEPORT
+    struct Listener{
+        std::string address{"::"}; // "::" also accepts IPv4 (dual-stack) and falls back to 0.0.0.0 on hosts without IPv6
+        uint16_t port{80};
+        bool tls{false}; // Needs use_https()
+        bool v6_only{false};
+        int backlog{asio::socket_base::max_listen_connections};
+        bool no_delay{true}; // TCP_NODELAY on accepted connections
+        int fast_open{0}; // TCP_FASTOPEN queue length, 0 leaves it off. Needs net.ipv4.tcp_fastopen to allow servers
+        // TCP_DEFER_ACCEPT, connections are only accepted once their first bytes arrived (or after this long),
+        // so idle connects never wake a thread. Zero accepts at once
+        std::chrono::seconds defer_accept{0};
+    };
+
+    struct TlsStats{
+        std::size_t full_handshakes;
+        std::size_t resumed_handshakes;
+        std::size_t failed_handshakes;
     };
 
 
     class Server{
     public:
         uint16_t port;
-        std::unordered_map<Endpoint, WebPoint::Handler> routes;
+        std::shared_ptr<Router> routes;
+        WebPoint::Handler (*static_routes)(RequestType, std::string_view){nullptr};
+        std::uint16_t (*static_allowed)(std::string_view){nullptr};
         std::string static_dir;
         std::filesystem::path static_path;
+        std::shared_ptr<StaticFileCache> static_cache;
         uint32_t thread_count{std::thread::hardware_concurrency()};
+        ThreadMode thread_mode{ThreadMode::Shared};
+        bool pin_threads{false};
+        std::size_t max_request_size{4 * 1024 * 1024};
+        std::size_t compression_min_size{std::numeric_limits<std::size_t>::max()};
         std::optional<SslConfig> ssl_config;
+        std::vector<Listener> listeners; // Empty listens on `port`, and on 443 for TLS once use_https() was called
+        std::string metrics_path; // Empty while metrics are off
+        std::shared_ptr<AccessLog> access_log;
         
-        Server(uint16_t port = 80): port{port} {}
+        bool stop_signals{false};
+        std::shared_ptr<ServerState> state;
+
+        Server(uint16_t port = 80);
 
         std::vector<std::unique_ptr<Middleware>> middlewares;
 
         Server& set_routes(std::vector<WebPoint> routes);
         Server& set_static_files(std::string directory, std::filesystem::path static_path);
+        Server& set_static_cache(std::size_t byte_budget);
+        Server& set_compression(std::size_t min_size = 1024);
         Server& set_threads(uint32_t count);
+        Server& set_thread_mode(ThreadMode mode, bool pin_to_cpus = false);
+        Server& set_max_request_size(std::size_t bytes);
         Server& use_https(std::string key_path, std::string private_path);
+        // Serves TLS on port 443 or the tls listeners, advertising http/1.1 through ALPN
+        Server& use_https(SslConfig config);
+        // Replaces the default listeners, call once per endpoint
+        Server& add_listener(Listener listener);
+        // Records request, connection and byte metrics and serves them as Prometheus text on `path`
+        Server& set_metrics(std::string path = "/metrics");
+        // Appends an entry per request to `file` from a background thread, entries are dropped rather than waited on
+        Server& set_access_log(const std::filesystem::path& file, AccessLogFormat format = AccessLogFormat::Common);
+        std::size_t access_log_dropped() const;
+        // SIGINT and SIGTERM stop the server gracefully
+        Server& stop_on_signals();
+        // Listening sockets passed by systemd socket activation or hand_over() are used instead of binding new ones
         void run() const;
+        // Stops accepting, closes idle connections and lets busy ones finish their response for up to `grace`,
+        // then run() returns. Safe from any thread, a server stopped before it runs returns from run() at once
+        void stop(std::chrono::steady_clock::duration grace = std::chrono::seconds(10)) const;
+        // Starts command[0] with command as its arguments, handing it the listening sockets systemd style
+        // (LISTEN_FDS), then stops this server once the new one runs. Connections keep being accepted throughout.
+        // Throws and keeps serving when the command can't be started or exits or stalls before it runs.
+        void hand_over(const std::vector<std::string>& command, std::chrono::steady_clock::duration grace = std::chrono::seconds(10)) const;
+
+        static BufferPoolStats buffer_pool_stats();
+        static TlsStats tls_stats();
+
+        // Routes known at compile time, see htpp/routes.h. Checked before the runtime routes
+        template<typename StaticRouteTable> requires requires { &StaticRouteTable::find; &StaticRouteTable::allowed; }
+        Server& set_routes(StaticRouteTable){
+            static_routes = &StaticRouteTable::find;
+            static_allowed = &StaticRouteTable::allowed;
+            return *this;
+        }
 
         template<typename T, typename ... Params>
         Server& add_middleware(Params&& ... params){
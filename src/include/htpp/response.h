@@ -1,44 +1,228 @@
 #pragma once
 #include <htpp/http.h>
-#include <sstream>
+#include <htpp/buffer.h>
+#include <array>
+#include <chrono>
 #include <optional>
+#include <limits>
+#include <span>
 #include <functional>
 #include <iostream>
+#include <filesystem>
 #include <asio/awaitable.hpp>
+#include <asio/ip/tcp.hpp>
 
 namespace htpp
 {
+    // Serves an open file, the body is handed to the kernel instead of passing through the response buffer
+    class FileResponse : public OkResponse{
+        int fd{-1};
+        std::size_t file_size{0};
+        ContentType type;
+    public:
+        Encoding encoding;
+        FileResponse(ContentType type, const std::filesystem::path& path, Encoding encoding = Encoding::Identity);
+        FileResponse(FileResponse&& other) noexcept;
+        FileResponse& operator=(FileResponse&&) = delete;
+        ~FileResponse();
+
+        bool is_open() const { return fd >= 0; }
+        int native_handle() const { return fd; }
+        ContentType content_type() const { return type; }
+        std::size_t content_size() const { return file_size; }
+    };
+
+    class ResponseStream;
+
+    struct ConnectionInfo{
+        asio::ip::tcp::endpoint remote;
+        bool secure;
+    };
+
+    // What middleware learns about a response once it has been handed to the connection
+    struct ResponseInfo{
+        uint16_t status;
+        std::size_t bytes; // Head and body as written, before TLS
+        std::chrono::steady_clock::duration duration; // From the complete request head
+    };
+
     class Context{
+        friend class ResponseStream;
+    public:
+        static constexpr std::size_t max_path_params = 8;
     protected:
-        std::stringstream response_buffer;
+        Request current_request{};
+        ConnectionInfo current_connection{};
+        bool keep_alive{true};
+        uint16_t response_status{0}; // Status of the response to the current request, 0 until one is started
+        ResponseBuffer response_buffer;
+        std::array<PathParam, max_path_params> path_param_storage;
+        std::size_t path_param_count{0};
+        Encoding accepted_encodings{Encoding::Identity};
+        std::size_t compression_min_size{std::numeric_limits<std::size_t>::max()};
+
+        // Compresses dynamic bodies above the configured size with the best encoding the client accepts
+        bool compress_body(ContentType type, std::string_view body, std::string& out, std::string_view& encoding_name) const;
         virtual void default_headers() = 0;
         [[nodiscard]] virtual asio::awaitable<void> send_response() = 0;
+        [[nodiscard]] virtual asio::awaitable<void> send_file(FileResponse file) = 0;
+        [[nodiscard]] virtual asio::awaitable<void> flush() = 0;
     public:
         // Don't override destructor, we shouldn't need it
 
+        // The request being handled, its views are valid until the handler returns
+        const Request& request() const { return current_request; }
+        const ConnectionInfo& connection_info() const { return current_connection; }
+
+        // Values captured by {name} segments of the matched route, valid until the handler returns
+        std::span<const PathParam> path_params() const {
+            return {path_param_storage.data(), path_param_count};
+        }
+
+        std::string_view path_param(std::string_view name) const {
+            for(const auto& param : path_params())
+                if(param.name == name)
+                    return param.value;
+            return {};
+        }
+
+        // Whole request body in one view, bounded by Server::set_max_request_size. Valid until the handler returns
+        [[nodiscard]] virtual asio::awaitable<std::string_view> body() = 0;
+
+        // Next piece of the request body as it arrives, empty once the body is complete. Valid until the next call.
+        // Use for uploads that should not be buffered whole, don't mix with body()
+        [[nodiscard]] virtual asio::awaitable<std::string_view> read_body() = 0;
+
         template<ResponseConcept ResponseType>
         [[nodiscard]] asio::awaitable<void> send(const ResponseType& response){
-            std::stringstream& s = response_buffer;
-            s << "HTTP/1.1 " << response.response_code();
+            ResponseBuffer& s = response_buffer;
+            response_status = response.response_code();
+            s << "HTTP/1.1 " << response_status;
             response.header_line(s);
             s  << " \r\n";
             default_headers();
+            if constexpr( HeadersConcept<ResponseType> )
+                response.headers(s);
             if constexpr( ContentConcept<ResponseType> ){
                 s << "Content-Type: " << to_str(response.content_type()) << "\r\n";
+                bool may_compress = accepted_encodings != Encoding::Identity && compression_min_size != std::numeric_limits<std::size_t>::max();
 
                 if constexpr( SizedContentConcept<ResponseType> ){
-                    s << "Content-Length: " << response.content_size() << "\r\n\r\n";
-                    response.print_content(s);
+                    if(!may_compress || response.content_size() < compression_min_size){
+                        s << "Content-Length: " << response.content_size() << "\r\n\r\n";
+                        response.print_content(s);
+                        return send_response();
+                    }
+                }
+
+                // Body goes first, the length header is slotted in front of it afterwards
+                auto body = s.checkpoint();
+                response.print_content(s);
+                auto body_size = s.size_since(body);
+                std::string compressed;
+                std::string_view encoding;
+                if(may_compress && body_size >= compression_min_size && compress_body(response.content_type(), s.copy_since(body), compressed, encoding)){
+                    s.truncate(body);
+                    s << "Content-Encoding: " << encoding << "\r\nVary: Accept-Encoding\r\n";
+                    s << "Content-Length: " << compressed.size() << "\r\n\r\n" << compressed;
                 }else{
-                    std::stringstream data{};// Consider improving this allocation
-                    response.print_content(data);
-                    s << "Content-Length: " << data.view().size() << "\r\n\r\n";
-                    s << data.rdbuf();
+                    auto length = s.checkpoint();
+                    s << "Content-Length: " << body_size << "\r\n\r\n";
+                    s.move_before(body, length);
                 }
             }else{
                 s << "\r\n";
             }
             return send_response();
         }
+
+        // Starts a chunked response for content whose size isn't known up front, see ResponseStream
+        template<ResponseConcept ResponseType>
+        [[nodiscard]] ResponseStream stream(const ResponseType& response, ContentType type);
+
+        [[nodiscard]] asio::awaitable<void> send(FileResponse response){
+            ResponseBuffer& s = response_buffer;
+            response_status = response.response_code();
+            s << "HTTP/1.1 " << response_status << " \r\n";
+            default_headers();
+            s << "Content-Type: " << to_str(response.content_type()) << "\r\n";
+            if(response.encoding != Encoding::Identity)
+                s << "Content-Encoding: " << to_str(response.encoding) << "\r\nVary: Accept-Encoding\r\n";
+            s << "Content-Length: " << response.content_size() << "\r\n\r\n";
+            return send_file(std::move(response));
+        }
     };
+
+    // Body written as Transfer-Encoding: chunked, or delimited by closing the connection for HTTP/1.0 clients. Data collects in the response buffer and goes out as a chunk
+    // on flush, awaiting the socket write so a slow client slows the producer down instead of growing memory.
+    class ResponseStream{
+        Context& context;
+        std::size_t chunk_start;
+        bool chunked;
+    public:
+        static constexpr std::size_t flush_threshold = 16 * 1024;
+
+        ResponseStream(Context& context, bool chunked): context{context}, chunk_start{context.response_buffer.checkpoint()}, chunked{chunked} {}
+
+        // Print directly into the pending chunk, follow up with flush_if_full
+        ResponseBuffer& buffer(){ return context.response_buffer; }
+
+        std::size_t pending() const { return context.response_buffer.size_since(chunk_start); }
+
+        [[nodiscard]] asio::awaitable<void> write(std::string_view data){
+            context.response_buffer.append(data);
+            co_await flush_if_full();
+        }
+
+        [[nodiscard]] asio::awaitable<void> flush_if_full(){
+            if(pending() >= flush_threshold)
+                co_await flush();
+        }
+
+        [[nodiscard]] asio::awaitable<void> flush(){
+            frame_chunk();
+            co_await context.flush();
+            chunk_start = context.response_buffer.checkpoint();
+        }
+
+        // Ends the body, the stream must not be used afterwards
+        [[nodiscard]] asio::awaitable<void> finish(){
+            frame_chunk();
+            if(chunked)
+                context.response_buffer << "0\r\n\r\n";
+            return context.send_response();
+        }
+
+    private:
+        void frame_chunk(){
+            auto& s = context.response_buffer;
+            auto size = s.size_since(chunk_start);
+            if(size == 0 || !chunked)
+                return;
+            auto header = s.checkpoint();
+            s.append_with(sizeof(size) * 2, [size](char* out){
+                return static_cast<std::size_t>(std::to_chars(out, out + sizeof(size) * 2, size, 16).ptr - out);
+            });
+            s << "\r\n";
+            s.move_before(chunk_start, header);
+            s << "\r\n";
+        }
+    };
+
+    template<ResponseConcept ResponseType>
+    ResponseStream Context::stream(const ResponseType& response, ContentType type){
+        bool chunked = current_request.version != Version::Http10;
+        if(!chunked)
+            keep_alive = false;
+        ResponseBuffer& s = response_buffer;
+        response_status = response.response_code();
+        s << "HTTP/1.1 " << response_status;
+        response.header_line(s);
+        s << " \r\n";
+        default_headers();
+        if constexpr( HeadersConcept<ResponseType> )
+            response.headers(s);
+        s << "Content-Type: " << to_str(type) << (chunked ? "\r\nTransfer-Encoding: chunked\r\n\r\n" : "\r\n\r\n");
+        return ResponseStream{*this, chunked};
+    }
 } // namespace htpp
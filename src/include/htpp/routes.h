@@ -0,0 +1,143 @@
+#pragma once
+#include <htpp/lib.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+
+//// Example:
+// using Routes = htpp::StaticRoutes<
+//     htpp::Route<htpp::RequestType::GET, "/json", handle_json>,
+//     htpp::Route<htpp::RequestType::GET, "/api/time", handle_time>>;
+// server.set_routes(Routes{});
+
+namespace htpp{
+    template<RequestType Type, StringLiteral Path, WebPoint::Handler Function>
+    struct Route{
+        static constexpr RequestType type = Type;
+        static constexpr std::string_view path{Path.value, sizeof(Path.value) - 1};
+        static constexpr WebPoint::Handler handler = Function;
+    };
+
+    // Route table laid out at compile time behind a perfect hash (hash and displace). A lookup is one hash of the url,
+    // one displacement read and one comparison
+    template<typename ... Routes>
+    class StaticRoutes{
+        struct Slot{
+            std::string_view path;
+            RequestType type{};
+            WebPoint::Handler handler{nullptr};
+        };
+
+        static constexpr std::size_t route_count = sizeof...(Routes);
+        static constexpr std::size_t bucket_count = std::bit_ceil(route_count);
+        static constexpr std::size_t table_size = std::bit_ceil(2 * route_count);
+        static constexpr std::uint32_t max_displacement = 1 << 16;
+
+        // Avalanches every input bit into the index bits, FNV alone leaves the last characters in the low bits only
+        static constexpr std::uint64_t mix(std::uint64_t h){
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdull;
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53ull;
+            return h ^ (h >> 33);
+        }
+
+        static constexpr std::uint64_t hash(RequestType type, std::string_view url){
+            std::uint64_t h = 0xcbf29ce484222325ull ^ static_cast<std::uint64_t>(type);
+            for(char c : url)
+                h = (h ^ static_cast<unsigned char>(c)) * 0x100000001b3ull;
+            return mix(h);
+        }
+
+        static constexpr std::size_t bucket_of(std::uint64_t h){
+            return static_cast<std::size_t>(h) & (bucket_count - 1);
+        }
+
+        static constexpr std::size_t slot_of(std::uint64_t h, std::uint32_t displacement){
+            return static_cast<std::size_t>(mix(h + displacement * 0x9e3779b97f4a7c15ull) >> 32) & (table_size - 1);
+        }
+
+        struct Layout{
+            std::array<std::uint32_t, bucket_count> displacements{};
+            std::array<Slot, table_size> table{};
+        };
+
+        // Places the fullest buckets first while the table is still empty, each bucket searches for a displacement
+        // that moves all of its routes into free slots
+        static constexpr Layout build(){
+            std::array<Slot, route_count> routes{Slot{Routes::path, Routes::type, Routes::handler}...};
+            std::array<std::uint64_t, route_count> hashes{};
+            std::array<std::size_t, bucket_count> sizes{};
+            std::size_t largest = 0;
+            for(std::size_t i = 0; i < route_count; i++){
+                hashes[i] = hash(routes[i].type, routes[i].path);
+                for(std::size_t j = 0; j < i; j++)
+                    if(hashes[i] == hashes[j] && routes[i].type == routes[j].type && routes[i].path == routes[j].path)
+                        throw std::logic_error{"A route is listed twice"};
+                largest = std::max(largest, ++sizes[bucket_of(hashes[i])]);
+            }
+
+            Layout layout;
+            std::array<bool, table_size> used{};
+            for(std::size_t size = largest; size > 0; size--){
+                for(std::size_t bucket = 0; bucket < bucket_count; bucket++){
+                    if(sizes[bucket] != size)
+                        continue;
+                    std::array<std::size_t, route_count> members{};
+                    std::size_t member_count = 0;
+                    for(std::size_t i = 0; i < route_count; i++)
+                        if(bucket_of(hashes[i]) == bucket)
+                            members[member_count++] = i;
+
+                    std::array<std::size_t, route_count> slots{};
+                    for(std::uint32_t displacement = 0;; displacement++){
+                        if(displacement == max_displacement)
+                            throw std::logic_error{"No perfect hash found for the route table"};
+                        bool fits = true;
+                        for(std::size_t m = 0; m < member_count && fits; m++){
+                            slots[m] = slot_of(hashes[members[m]], displacement);
+                            fits = !used[slots[m]];
+                            for(std::size_t other = 0; other < m && fits; other++)
+                                fits = slots[other] != slots[m];
+                        }
+                        if(!fits)
+                            continue;
+                        for(std::size_t m = 0; m < member_count; m++){
+                            used[slots[m]] = true;
+                            layout.table[slots[m]] = routes[members[m]];
+                        }
+                        layout.displacements[bucket] = displacement;
+                        break;
+                    }
+                }
+            }
+            return layout;
+        }
+
+        static constexpr Layout layout = build();
+
+    public:
+        static_assert(sizeof...(Routes) > 0, "StaticRoutes needs at least one route");
+
+        static constexpr WebPoint::Handler find(RequestType type, std::string_view url){
+            auto h = hash(type, url);
+            const Slot& slot = layout.table[slot_of(h, layout.displacements[bucket_of(h)])];
+            if(slot.type == type && slot.path == url)
+                return slot.handler;
+            return nullptr;
+        }
+
+        // Methods url has a route for, a bit per RequestType, for the Allow header of a 405
+        static constexpr std::uint16_t allowed(std::string_view url){
+            std::uint16_t methods = 0;
+            for(std::size_t i = 0; i <= static_cast<std::size_t>(RequestType::PATCH); i++)
+                if(find(static_cast<RequestType>(i), url) != nullptr)
+                    methods |= static_cast<std::uint16_t>(1u << i);
+            return methods;
+        }
+    };
+}
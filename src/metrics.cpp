@@ -0,0 +1,132 @@
+#include "metrics.h"
+#include "buffer_pool.h"
+#include "tls.h"
+
+#include <map>
+#include <utility>
+
+namespace htpp{
+    namespace{
+        // Bucket bounds exported to Prometheus, in seconds and in the histogram's microseconds
+        constexpr std::array<std::pair<std::string_view, uint64_t>, 16> exported_bounds{{
+            {"0.0001", 100}, {"0.00025", 250}, {"0.0005", 500}, {"0.001", 1000}, {"0.0025", 2500}, {"0.005", 5000},
+            {"0.01", 10000}, {"0.025", 25000}, {"0.05", 50000}, {"0.1", 100000}, {"0.25", 250000}, {"0.5", 500000},
+            {"1", 1000000}, {"2.5", 2500000}, {"5", 5000000}, {"10", 10000000}
+        }};
+
+        constexpr std::array<std::string_view, 5> class_names{"1xx", "2xx", "3xx", "4xx", "5xx"};
+
+        struct Merged{
+            std::array<uint64_t, LatencyHistogram::bucket_count> counts{};
+            uint64_t sum_micros{0};
+        };
+
+        void write_label(ResponseBuffer& out, std::string_view value){
+            for(char c : value){
+                if(c == '"' || c == '\\')
+                    out << '\\' << c;
+                else if(c == '\n')
+                    out << "\\n";
+                else
+                    out << c;
+            }
+        }
+
+        void write_metric(ResponseBuffer& out, std::string_view name, std::string_view type, std::string_view help, uint64_t value){
+            out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' ' << type << '\n' << name << ' ' << value << '\n';
+        }
+    }
+
+    LatencyHistogram& Metrics::histogram(std::string_view route, uint16_t status){
+        auto status_class = std::min<std::size_t>(std::max<std::size_t>(status / 100, 1) - 1, status_classes - 1);
+        auto& shard = local();
+        auto it = shard.routes.find(route); // Only this thread inserts, so finding without the lock is safe
+        if(it == shard.routes.end()){
+            auto guard = std::lock_guard{shard.routes_lock};
+            it = shard.routes.emplace(std::string{route}, Route{}).first;
+        }
+        auto& histogram = it->second.by_class[status_class];
+        if(histogram == nullptr){
+            auto guard = std::lock_guard{shard.routes_lock};
+            histogram = std::make_unique<LatencyHistogram>();
+        }
+        return *histogram;
+    }
+
+    void Metrics::write_prometheus(ResponseBuffer& out){
+        uint64_t opened = 0, closed = 0, idle_entered = 0, idle_left = 0, received = 0, sent = 0;
+        std::map<std::pair<std::string, std::size_t>, Merged> merged;
+        {
+            auto guard = std::lock_guard{registry_lock()};
+            for(const auto& shard : shards()){
+                opened += shard->connections_opened.load(std::memory_order_relaxed);
+                closed += shard->connections_closed.load(std::memory_order_relaxed);
+                idle_entered += shard->idle_entered.load(std::memory_order_relaxed);
+                idle_left += shard->idle_left.load(std::memory_order_relaxed);
+                received += shard->bytes_received.load(std::memory_order_relaxed);
+                sent += shard->bytes_sent.load(std::memory_order_relaxed);
+
+                auto routes_guard = std::lock_guard{shard->routes_lock};
+                for(const auto& [route, stats] : shard->routes){
+                    for(std::size_t i = 0; i < status_classes; i++){
+                        if(stats.by_class[i] == nullptr)
+                            continue;
+                        auto& target = merged[{route, i}];
+                        for(std::size_t bucket = 0; bucket < LatencyHistogram::bucket_count; bucket++)
+                            target.counts[bucket] += stats.by_class[i]->counts[bucket].load(std::memory_order_relaxed);
+                        target.sum_micros += stats.by_class[i]->sum_micros.load(std::memory_order_relaxed);
+                    }
+                }
+            }
+        }
+
+        // Connections can close on another thread than they opened on, only the totals balance
+        write_metric(out, "htpp_connections_opened_total", "counter", "Accepted connections.", opened);
+        write_metric(out, "htpp_connections_open", "gauge", "Connections currently open.", opened - std::min(opened, closed));
+        write_metric(out, "htpp_connections_idle", "gauge", "Open connections waiting for their next request.", idle_entered - std::min(idle_entered, idle_left));
+        write_metric(out, "htpp_received_bytes_total", "counter", "Bytes read from clients.", received);
+        write_metric(out, "htpp_sent_bytes_total", "counter", "Bytes written to clients.", sent);
+        auto pool = BufferPool::stats();
+        write_metric(out, "htpp_request_buffers_in_use", "gauge", "Pooled request buffers held by connections.", pool.in_use);
+        write_metric(out, "htpp_request_buffers_grown_total", "counter", "Request buffers grown beyond one block.", pool.grown);
+        auto tls = TlsContext::stats();
+        out << "# HELP htpp_tls_handshakes_total TLS handshakes by outcome, resumed ones skipped the key exchange.\n"
+               "# TYPE htpp_tls_handshakes_total counter\n"
+               "htpp_tls_handshakes_total{result=\"full\"} " << tls.full_handshakes << "\n"
+               "htpp_tls_handshakes_total{result=\"resumed\"} " << tls.resumed_handshakes << "\n"
+               "htpp_tls_handshakes_total{result=\"failed\"} " << tls.failed_handshakes << '\n';
+
+        out << "# HELP htpp_request_duration_seconds Time from a complete request head to the response being handed to the socket.\n"
+               "# TYPE htpp_request_duration_seconds histogram\n";
+        for(const auto& [key, histogram] : merged){
+            const auto& [route, status_class] = key;
+            auto labels = [&, route = std::string_view{route}, status_class = status_class](){
+                out << "{route=\"";
+                write_label(out, route);
+                out << "\",status=\"" << class_names[status_class] << '"';
+            };
+
+            uint64_t cumulative = 0;
+            std::size_t bucket = 0;
+            for(auto [name, bound] : exported_bounds){
+                for(; bucket < LatencyHistogram::bucket_count && LatencyHistogram::upper_bound(bucket) <= bound; bucket++)
+                    cumulative += histogram.counts[bucket];
+                out << "htpp_request_duration_seconds_bucket";
+                labels();
+                out << ",le=\"" << name << "\"} " << cumulative << '\n';
+            }
+            for(; bucket < LatencyHistogram::bucket_count; bucket++)
+                cumulative += histogram.counts[bucket];
+            out << "htpp_request_duration_seconds_bucket";
+            labels();
+            out << ",le=\"+Inf\"} " << cumulative << '\n';
+
+            out << "htpp_request_duration_seconds_sum";
+            labels();
+            out << "} " << static_cast<double>(histogram.sum_micros) / 1e6 << '\n';
+            out << "htpp_request_duration_seconds_count";
+            labels();
+            out << "} " << cumulative << '\n';
+        }
+    }
+}
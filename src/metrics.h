@@ -0,0 +1,121 @@
+#pragma once
+#include <htpp/buffer.h>
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace htpp{
+    // Log-linear histogram of microseconds, eight buckets per power of two keep the error of any bucket below 12.5%.
+    // Written by a single thread, readers on other threads see relaxed but untorn counts.
+    class LatencyHistogram{
+    public:
+        static constexpr std::size_t sub_buckets = 8;
+        static constexpr std::size_t max_magnitude = 34; // 2^35us is about 9.5 hours, longer requests land in the last bucket
+        static constexpr std::size_t bucket_count = sub_buckets * (max_magnitude - 1);
+
+        static constexpr std::size_t bucket_of(uint64_t micros){
+            micros = std::min<uint64_t>(micros, (uint64_t{2} << max_magnitude) - 1);
+            if(micros < sub_buckets)
+                return static_cast<std::size_t>(micros);
+            auto magnitude = static_cast<std::size_t>(std::bit_width(micros)) - 1;
+            auto shift = magnitude - 3;
+            return sub_buckets + shift * sub_buckets + static_cast<std::size_t>((micros >> shift) - sub_buckets);
+        }
+
+        // Largest value counted in the bucket
+        static constexpr uint64_t upper_bound(std::size_t bucket){
+            if(bucket < sub_buckets)
+                return bucket;
+            auto shift = (bucket - sub_buckets) / sub_buckets;
+            auto top = (bucket - sub_buckets) % sub_buckets + sub_buckets;
+            return ((top + 1) << shift) - 1;
+        }
+
+        void record(uint64_t micros){
+            bump(counts[bucket_of(micros)], 1);
+            bump(sum_micros, micros);
+        }
+
+        static void bump(std::atomic<uint64_t>& counter, uint64_t amount){
+            counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed); // Single writer, no locked add
+        }
+
+        std::array<std::atomic<uint64_t>, bucket_count> counts{};
+        std::atomic<uint64_t> sum_micros{0};
+    };
+    static_assert(LatencyHistogram::bucket_of(7) == 7 && LatencyHistogram::bucket_of(8) == 8 && LatencyHistogram::bucket_of(15) == 15);
+    static_assert(LatencyHistogram::upper_bound(LatencyHistogram::bucket_of(1000)) >= 1000);
+    static_assert(LatencyHistogram::bucket_of(~uint64_t{0}) == LatencyHistogram::bucket_count - 1);
+
+    // Process wide request metrics. Every thread writes its own shard without contention, a scrape merges them.
+    class Metrics{
+        static constexpr std::size_t status_classes = 5;
+
+        struct StringHash{
+            using is_transparent = void;
+            std::size_t operator()(std::string_view str) const noexcept { return std::hash<std::string_view>{}(str); }
+        };
+
+        struct Route{
+            std::array<std::unique_ptr<LatencyHistogram>, status_classes> by_class; // Created on first use
+        };
+
+        struct Shard{
+            std::atomic<uint64_t> connections_opened{0};
+            std::atomic<uint64_t> connections_closed{0};
+            std::atomic<uint64_t> idle_entered{0};
+            std::atomic<uint64_t> idle_left{0};
+            std::atomic<uint64_t> bytes_received{0};
+            std::atomic<uint64_t> bytes_sent{0};
+            std::mutex routes_lock; // Held by the owner only to add routes, and by scrapes
+            std::unordered_map<std::string, Route, StringHash, std::equal_to<>> routes;
+        };
+
+        static std::mutex& registry_lock(){
+            static std::mutex instance;
+            return instance;
+        }
+
+        // Shards outlive their threads so totals keep counting what finished threads did
+        static std::vector<std::unique_ptr<Shard>>& shards(){
+            static std::vector<std::unique_ptr<Shard>> instance;
+            return instance;
+        }
+
+        static Shard& local(){
+            thread_local Shard* shard = []{
+                auto guard = std::lock_guard{registry_lock()};
+                return shards().emplace_back(std::make_unique<Shard>()).get();
+            }();
+            return *shard;
+        }
+
+        static LatencyHistogram& histogram(std::string_view route, uint16_t status);
+
+    public:
+        static void connection_opened(){ LatencyHistogram::bump(local().connections_opened, 1); }
+        static void connection_closed(){ LatencyHistogram::bump(local().connections_closed, 1); }
+        static void idle_entered(){ LatencyHistogram::bump(local().idle_entered, 1); }
+        static void idle_left(){ LatencyHistogram::bump(local().idle_left, 1); }
+        static void received(std::size_t bytes){ LatencyHistogram::bump(local().bytes_received, bytes); }
+        static void sent(std::size_t bytes){ LatencyHistogram::bump(local().bytes_sent, bytes); }
+
+        // Route is the pattern that matched, never the raw url, so label cardinality stays bounded
+        static void request(std::string_view route, uint16_t status, std::chrono::steady_clock::duration duration){
+            auto micros = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+            histogram(route, status).record(static_cast<uint64_t>(std::max<decltype(micros)>(micros, 0)));
+        }
+
+        // Prometheus text exposition format 0.0.4
+        static void write_prometheus(ResponseBuffer& out);
+    };
+}
@@ -0,0 +1,244 @@
+#pragma once
+#include <htpp/http.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace htpp{
+    // Walks the bytes of a request head that equal one of Delimiters, in order. Each window of the head is
+    // classified with one vector compare per delimiter into a bitmask, so short tokens cost a few bit operations
+    // instead of a search each. Uses AVX2 when the target has it, SSE2 on any other x86-64 and a byte loop elsewhere.
+    template<char... Delimiters>
+    class DelimiterScanner{
+#if defined(__AVX2__)
+        static constexpr std::ptrdiff_t window = 32;
+#elif defined(__SSE2__)
+        static constexpr std::ptrdiff_t window = 16;
+#else
+        static constexpr std::ptrdiff_t window = 32;
+#endif
+        const char* base;
+        const char* end;
+        uint32_t mask{0};
+
+        void classify(){
+            if(end - base >= window){
+#if defined(__AVX2__)
+                auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(base));
+                auto hits = _mm256_setzero_si256();
+                ((hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, _mm256_set1_epi8(Delimiters)))), ...);
+                mask = static_cast<uint32_t>(_mm256_movemask_epi8(hits));
+                return;
+#elif defined(__SSE2__)
+                auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(base));
+                auto hits = _mm_setzero_si128();
+                ((hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, _mm_set1_epi8(Delimiters)))), ...);
+                mask = static_cast<uint32_t>(_mm_movemask_epi8(hits));
+                return;
+#endif
+            }
+            mask = 0; // Tail shorter than a window, never read past the head
+            for(std::ptrdiff_t i = 0; i < std::min(window, end - base); i++)
+                if(((base[i] == Delimiters) || ...))
+                    mask |= 1u << i;
+        }
+
+    public:
+        DelimiterScanner(const char* begin, const char* end): base{begin}, end{end} {
+            if(base != end)
+                classify();
+        }
+
+        // Next delimiter, or end once the head is exhausted
+        const char* next(){
+            while(mask == 0){
+                base += window;
+                if(base >= end)
+                    return end;
+                classify();
+            }
+            auto found = base + std::countr_zero(mask);
+            mask &= mask - 1;
+            return found;
+        }
+    };
+
+    // Up to eight bytes as the little endian word a memcpy load produces
+    consteval uint64_t pattern_word(std::string_view bytes){
+        uint64_t word = 0;
+        for(std::size_t i = 0; i < bytes.size(); i++)
+            word |= static_cast<uint64_t>(static_cast<unsigned char>(bytes[i])) << (8 * i);
+        return word;
+    }
+
+    consteval uint64_t pattern_mask(std::size_t length){
+        return length == 8 ? ~uint64_t{0} : (uint64_t{1} << (8 * length)) - 1;
+    }
+
+    inline uint64_t load_word(const char* data){
+        static_assert(std::endian::native == std::endian::little, "Request parsing compares little endian words");
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        return word;
+    }
+
+    constexpr bool is_token_char(char c){
+        return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || std::string_view{"!#$%&'*+-.^_`|~"}.contains(c);
+    }
+
+    // Matches the method together with the space after it in one masked word compare. The first byte picks the
+    // candidate, so garbage such as "GARBAGE" no longer passes as GET. Needs eight readable bytes at `it`.
+    inline RequestType parse_method(const char*& it){
+        using enum RequestType;
+        struct Method{ uint64_t word; uint64_t mask; std::size_t length; RequestType type; };
+        static constexpr Method methods[]{
+            {pattern_word("GET "), pattern_mask(4), 4, GET},
+            {pattern_word("HEAD "), pattern_mask(5), 5, HEAD},
+            {pattern_word("POST "), pattern_mask(5), 5, POST},
+            {pattern_word("PUT "), pattern_mask(4), 4, PUT},
+            {pattern_word("DELETE "), pattern_mask(7), 7, DELETE},
+            {pattern_word("CONNECT "), pattern_mask(8), 8, CONNECT},
+            {pattern_word("OPTIONS "), pattern_mask(8), 8, OPTIONS},
+            {pattern_word("TRACE "), pattern_mask(6), 6, TRACE},
+            {pattern_word("PATCH "), pattern_mask(6), 6, PATCH},
+        };
+        std::size_t candidate;
+        switch(it[0]){
+            case 'G': candidate = 0; break;
+            case 'H': candidate = 1; break;
+            case 'P': candidate = it[1] == 'O' ? 2 : it[1] == 'U' ? 3 : 8; break;
+            case 'D': candidate = 4; break;
+            case 'C': candidate = 5; break;
+            case 'O': candidate = 6; break;
+            case 'T': candidate = 7; break;
+            default: candidate = std::size(methods);
+        }
+        auto word = load_word(it);
+        if(candidate < std::size(methods) && (word & methods[candidate].mask) == methods[candidate].word){
+            it += methods[candidate].length;
+            return methods[candidate].type;
+        }
+
+        // A well formed method the server doesn't implement is told apart from junk
+        auto token_end = it;
+        while(is_token_char(*token_end))
+            token_end++;
+        if(token_end != it && *token_end == ' ')
+            throw HttpError{405, "Method Not Allowed"};
+        throw HttpError{400, "Bad Request"};
+    }
+
+    // Parses "METHOD target HTTP/1.x\r\n" at the start of the head into the request and returns where the header
+    // block starts. The target is split at the first '?' and ended by the space before the version in one scan.
+    inline const char* parse_request_line(std::string_view head, Request& request){
+        constexpr std::string_view shortest{"GET / HTTP/1.1\r\n\r\n"};
+        if(head.size() < shortest.size())
+            throw HttpError{400, "Bad Request"};
+        const char* it = head.data();
+        const char* end = it + head.size();
+        request.type = parse_method(it);
+
+        DelimiterScanner<' ', '?', '\r'> scanner{it, end};
+        auto delimiter = scanner.next();
+        request.param = {};
+        if(delimiter != end && *delimiter == '?'){
+            request.url = {it, delimiter};
+            auto query = delimiter + 1;
+            do{
+                delimiter = scanner.next();
+            }while(delimiter != end && *delimiter == '?');
+            request.param = {query, delimiter};
+        }else{
+            request.url = {it, delimiter};
+        }
+        if(delimiter == end || *delimiter != ' ' || request.url.empty())
+            throw HttpError{400, "Bad Request"};
+
+        // " HTTP/1.x\r\n" is eleven bytes, the head always ends in another CRLF so ten of them are loaded as words
+        it = delimiter + 1;
+        if(end - it < 10)
+            throw HttpError{400, "Bad Request"};
+        auto version = load_word(it);
+        constexpr auto prefix = pattern_word("HTTP/");
+        constexpr auto prefix_mask = pattern_mask(5);
+        if((version & prefix_mask) != prefix)
+            throw HttpError{400, "Bad Request"};
+        if((version & pattern_mask(7)) != pattern_word("HTTP/1.") || (it[7] != '0' && it[7] != '1') || it[8] != '\r' || it[9] != '\n'){
+            bool versioned = it[5] >= '0' && it[5] <= '9';
+            throw versioned ? HttpError{505, "HTTP Version Not Supported"} : HttpError{400, "Bad Request"};
+        }
+        request.version = it[7] == '0' ? Version::Http10 : Version::Http11;
+        return it + 10;
+    }
+
+    constexpr bool is_header_space(char c){
+        return c == ' ' || c == '\t';
+    }
+
+    // Field names are tokens, RFC 9110 5.6.2. Anything else, CR and whitespace included, could be read as another
+    // header by a proxy in front.
+    inline constexpr auto tchar_table = []{
+        std::array<bool, 256> table{};
+        for(unsigned char c : std::string_view{"!#$%&'*+-.^_`|~"})
+            table[c] = true;
+        for(unsigned char c = '0'; c <= '9'; c++)
+            table[c] = true;
+        for(unsigned char c = 'a'; c <= 'z'; c++)
+            table[c] = table[c - 0x20] = true;
+        return table;
+    }();
+
+    constexpr bool is_tchar(char c){
+        return tchar_table[static_cast<unsigned char>(c)];
+    }
+
+    // Splits the header block following the request line into the table, the block ends with the empty line.
+    // Values have surrounding whitespace removed, obsolete line folding, bare line feeds and names that aren't
+    // tokens, whitespace before the colon included, are rejected.
+    inline void tokenize_headers(std::string_view block, Headers& headers){
+        headers.clear();
+        const char* it = block.data();
+        const char* end = it + block.size();
+        DelimiterScanner<':', '\n'> delimiters{it, end};
+        while(true){
+            auto colon = delimiters.next();
+            if(colon == end)
+                throw HttpError{400, "Bad Request"};
+            if(*colon == '\n'){
+                if(colon != it + 1 || *it != '\r')
+                    throw HttpError{400, "Bad Request"};
+                return;
+            }
+            if(colon == it || !std::all_of(it, colon, is_tchar))
+                throw HttpError{400, "Bad Request"};
+
+            auto line_end = delimiters.next();
+            while(line_end != end && *line_end == ':') // Values such as Host: example.com:8080 contain colons
+                line_end = delimiters.next();
+            if(line_end == end || line_end[-1] != '\r')
+                throw HttpError{400, "Bad Request"};
+
+            auto value_start = colon + 1;
+            auto value_end = line_end - 1;
+            while(value_start != value_end && is_header_space(*value_start))
+                value_start++;
+            while(value_end != value_start && is_header_space(value_end[-1]))
+                value_end--;
+
+            std::string_view name{it, colon};
+            if(!headers.add(name, {value_start, value_end}, header_id(name)))
+                throw HttpError{431, "Request Header Fields Too Large"};
+            it = line_end + 1;
+        }
+    }
+}
@@ -0,0 +1,134 @@
+#include "router.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace htpp{
+    namespace{
+        // Splits off the segment after a leading '/', the rest keeps its own leading '/'
+        std::pair<std::string_view, std::string_view> next_segment(std::string_view path){
+            path.remove_prefix(1);
+            auto slash = path.find('/');
+            if(slash == std::string_view::npos)
+                return {path, {}};
+            return {path.substr(0, slash), path.substr(slash)};
+        }
+
+        template<typename Handlers>
+        std::uint16_t allowed_methods(const Handlers& handlers){
+            std::uint16_t allowed = 0;
+            for(std::size_t i = 0; i < handlers.size(); i++)
+                if(handlers[i] != nullptr)
+                    allowed |= static_cast<std::uint16_t>(1u << i);
+            return allowed;
+        }
+    }
+
+    std::uint32_t Router::static_child(std::uint32_t node, std::string_view segment) const {
+        const auto& children = nodes[node].children;
+        auto it = std::lower_bound(children.begin(), children.end(), segment, [&](std::uint32_t child, std::string_view value){
+            return nodes[child].segment < value;
+        });
+        if(it != children.end() && nodes[*it].segment == segment)
+            return *it;
+        return none;
+    }
+
+    std::uint32_t Router::add_node(std::string_view segment){
+        nodes.emplace_back().segment = segment;
+        return static_cast<std::uint32_t>(nodes.size() - 1);
+    }
+
+    void Router::add(RequestType type, std::string_view pattern, WebPoint::Handler handler){
+        if(!pattern.starts_with('/'))
+            throw std::invalid_argument{"Route must start with '/'"};
+
+        std::uint32_t node = 0;
+        std::size_t captures = 0;
+        std::string_view rest = pattern == "/" ? std::string_view{} : pattern;
+        while(!rest.empty()){
+            auto [segment, remaining] = next_segment(rest);
+            rest = remaining;
+
+            if(segment.starts_with("{*") && segment.ends_with('}')){
+                if(!rest.empty())
+                    throw std::invalid_argument{"Wildcard must be the last segment"};
+                if(nodes[node].wildcard_child == none){
+                    nodes[node].wildcard_child = add_node(segment.substr(2, segment.size() - 3));
+                }
+                node = nodes[node].wildcard_child;
+                captures++;
+            }else if(segment.starts_with('{') && segment.ends_with('}')){
+                auto name = segment.substr(1, segment.size() - 2);
+                if(nodes[node].param_child == none){
+                    nodes[node].param_child = add_node(name);
+                }else if(nodes[nodes[node].param_child].segment != name){
+                    throw std::invalid_argument{"Conflicting parameter names at the same position"};
+                }
+                node = nodes[node].param_child;
+                captures++;
+            }else{
+                auto child = static_child(node, segment);
+                if(child == none){
+                    child = add_node(segment);
+                    auto& children = nodes[node].children;
+                    children.insert(std::upper_bound(children.begin(), children.end(), segment, [&](std::string_view value, std::uint32_t other){
+                        return value < nodes[other].segment;
+                    }), child);
+                }
+                node = child;
+            }
+        }
+        if(captures > Context::max_path_params)
+            throw std::invalid_argument{"Too many parameters in route"};
+
+        auto& target = nodes[node];
+        if(target.handlers[static_cast<std::size_t>(type)] == nullptr)
+            route_count++;
+        target.handlers[static_cast<std::size_t>(type)] = handler;
+        target.has_handler = true;
+        target.pattern = pattern;
+    }
+
+    bool Router::match(std::uint32_t node, std::string_view path, RequestType type, std::span<PathParam> params, Match& result, std::size_t depth) const {
+        const Node& current = nodes[node];
+        if(path.empty()){
+            if(!current.has_handler)
+                return false;
+            result.handler = current.handlers[static_cast<std::size_t>(type)];
+            result.pattern = current.pattern;
+            result.param_count = depth;
+            result.method_not_allowed = result.handler == nullptr;
+            result.allowed_methods = result.method_not_allowed ? allowed_methods(current.handlers) : 0;
+            return result.handler != nullptr;
+        }
+
+        auto [segment, rest] = next_segment(path);
+        if(auto child = static_child(node, segment); child != none && match(child, rest, type, params, result, depth))
+            return true;
+        if(current.param_child != none && !segment.empty()){
+            params[depth] = {nodes[current.param_child].segment, segment};
+            if(match(current.param_child, rest, type, params, result, depth + 1))
+                return true;
+        }
+        if(current.wildcard_child != none){
+            const Node& wildcard = nodes[current.wildcard_child];
+            params[depth] = {wildcard.segment, path.substr(1)};
+            result.handler = wildcard.handlers[static_cast<std::size_t>(type)];
+            result.pattern = wildcard.pattern;
+            result.param_count = depth + 1;
+            result.method_not_allowed = result.handler == nullptr;
+            result.allowed_methods = result.method_not_allowed ? allowed_methods(wildcard.handlers) : 0;
+            return result.handler != nullptr;
+        }
+        return false;
+    }
+
+    Router::Match Router::find(RequestType type, std::string_view path, std::span<PathParam> params) const {
+        Match result;
+        if(!path.starts_with('/'))
+            return result;
+        match(0, path == "/" ? std::string_view{} : path, type, params, result, 0);
+        return result;
+    }
+}
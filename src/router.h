@@ -0,0 +1,54 @@
+#pragma once
+#include <htpp/lib.h>
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace htpp{
+    // Segment trie over route patterns, e.g. /api/users/{id}/orders or /files/{*path}.
+    // Static segments win over {param} captures which win over {*wildcard} tails, lookups backtrack when a branch dead ends.
+    class Router{
+    public:
+        static constexpr std::size_t method_count = static_cast<std::size_t>(RequestType::PATCH) + 1;
+
+        struct Match{
+            WebPoint::Handler handler{nullptr};
+            std::string_view pattern; // As registered, lives as long as the router
+            std::size_t param_count{0};
+            bool method_not_allowed{false}; // The path exists but has no handler for the method
+            std::uint16_t allowed_methods{0}; // With method_not_allowed, a bit per RequestType the path has a handler for
+        };
+
+        void add(RequestType type, std::string_view pattern, WebPoint::Handler handler);
+
+        // Captured values point into `path`, params must hold Context::max_path_params entries
+        Match find(RequestType type, std::string_view path, std::span<PathParam> params) const;
+
+        std::size_t size() const { return route_count; }
+
+    private:
+        static constexpr std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+
+        struct Node{
+            std::string segment; // Static text, or the capture name of param and wildcard nodes
+            std::string pattern; // Route ending at this node
+            std::vector<std::uint32_t> children; // Static children sorted by segment
+            std::uint32_t param_child{none};
+            std::uint32_t wildcard_child{none};
+            std::array<WebPoint::Handler, method_count> handlers{};
+            bool has_handler{false};
+        };
+
+        std::vector<Node> nodes{1};
+        std::size_t route_count{0};
+
+        std::uint32_t add_node(std::string_view segment);
+        std::uint32_t static_child(std::uint32_t node, std::string_view segment) const;
+        bool match(std::uint32_t node, std::string_view path, RequestType type, std::span<PathParam> params, Match& result, std::size_t depth) const;
+    };
+}
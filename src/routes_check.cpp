@@ -0,0 +1,47 @@
+// Compile time checks of StaticRoutes, nothing here runs
+#include <htpp/routes.h>
+
+#include <utility>
+
+namespace{
+    asio::awaitable<void> handler(htpp::Context&, std::string_view){ co_return; }
+    asio::awaitable<void> other_handler(htpp::Context&, std::string_view){ co_return; }
+
+    using enum htpp::RequestType;
+
+    // Route tables whose paths differ only in their last characters must still get a perfect hash
+    using Versions = htpp::StaticRoutes<
+        htpp::Route<GET, "/api/v1", handler>,
+        htpp::Route<GET, "/api/v2", other_handler>,
+        htpp::Route<POST, "/api/v2", handler>>;
+    static_assert(Versions::find(GET, "/api/v1") == handler);
+    static_assert(Versions::find(GET, "/api/v2") == other_handler);
+    static_assert(Versions::find(POST, "/api/v2") == handler);
+    static_assert(Versions::find(GET, "/api/v3") == nullptr);
+    static_assert(Versions::find(POST, "/api/v1") == nullptr);
+
+    // Feeds the Allow header of a 405
+    static_assert(Versions::allowed("/api/v1") == 1u << static_cast<int>(GET));
+    static_assert(Versions::allowed("/api/v2") == ((1u << static_cast<int>(GET)) | (1u << static_cast<int>(POST))));
+    static_assert(Versions::allowed("/api/v3") == 0);
+
+    // "/api/r0" to "/api/r<count - 1>"
+    template<std::size_t I>
+    constexpr auto numbered_path = []{
+        constexpr std::size_t digits = I < 10 ? 1 : I < 100 ? 2 : 3;
+        char path[6 + digits + 1]{'/', 'a', 'p', 'i', '/', 'r'};
+        for(std::size_t i = 0, rest = I; i < digits; i++, rest /= 10)
+            path[6 + digits - 1 - i] = static_cast<char>('0' + rest % 10);
+        return htpp::StringLiteral<sizeof(path)>{path};
+    }();
+
+    template<typename> struct NumberedRoutes;
+    template<std::size_t... I>
+    struct NumberedRoutes<std::index_sequence<I...>>{
+        using Table = htpp::StaticRoutes<htpp::Route<GET, numbered_path<I>, handler>...>;
+        static constexpr bool all_found = ((Table::find(GET, numbered_path<I>.value) == handler) && ...);
+    };
+    static_assert(NumberedRoutes<std::make_index_sequence<4>>::all_found);
+    static_assert(NumberedRoutes<std::make_index_sequence<100>>::all_found);
+    static_assert(NumberedRoutes<std::make_index_sequence<100>>::Table::find(GET, "/api/r100") == nullptr);
+}
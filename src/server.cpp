@@ -3,19 +3,38 @@
 #include "connection.h"
 #include "simple_connection.h"
 #include "ssl_connection.h"
+#include "static_cache.h"
+#include "router.h"
+#include "metrics.h"
+#include "access_log.h"
+#include "shutdown.h"
+#include "tls.h"
 
 #include <string>
+#include <cstring>
 #include <numeric>
 #include <vector>
 #include <span>
-#include <fstream>
 #include <filesystem>
 #include <iostream>
 #include <functional>
 #include <utility>
 #include <map>
+#include <optional>
 #include <asio.hpp>
 
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 #ifndef HTPP_VERSION
 #define HTPP_VERSION "unversioned"
 #endif
@@ -25,20 +44,60 @@ using namespace std::literals::string_view_literals;
 using namespace htpp;
 
 constexpr static auto ERROR_404 = "404 Not Found";
+constexpr static auto ERROR_405 = "405 Method Not Allowed";
 
 class StringResponse : public Response{
     std::string_view content;
 public:
     StringResponse(uint16_t code, std::string_view content): Response{code}, content{content} {}
-    void print_content(std::stringstream& s) const { s << content; }
+    void print_content(ResponseBuffer& s) const { s << content; }
     ContentType content_type() const { return ContentType::TextPlain; }
     std::size_t content_size() const { return content.size(); }
 };
 static_assert(SizedContentConcept<StringResponse>);
 
+// RFC 9110 15.5.6, a 405 lists the methods the path does allow
+class MethodNotAllowedResponse : public StringResponse{
+    std::uint16_t allowed;
+public:
+    explicit MethodNotAllowedResponse(std::uint16_t allowed): StringResponse{405, ERROR_405}, allowed{allowed} {}
+    void headers(ResponseBuffer& s) const {
+        s << "Allow: ";
+        std::string_view separator;
+        for(std::size_t i = 0; i < Router::method_count; i++){
+            if(allowed & (1u << i)){
+                s << separator << to_str(static_cast<RequestType>(i));
+                separator = ", ";
+            }
+        }
+        s << "\r\n";
+    }
+};
+static_assert(SizedContentConcept<MethodNotAllowedResponse> && HeadersConcept<MethodNotAllowedResponse>);
+
+struct MetricsResponse : public OkResponse{
+    void print_content(ResponseBuffer& s) const { Metrics::write_prometheus(s); }
+    ContentType content_type() const { return ContentType::TextPlain; }
+};
+static_assert(ContentConcept<MetricsResponse>);
+
+class RejectionResponse : public Response{
+    std::string_view message;
+public:
+    explicit RejectionResponse(const Rejection& rejection): Response{rejection.status}, message{rejection.message} {}
+    void print_content(ResponseBuffer& s) const { s << message; }
+    ContentType content_type() const { return ContentType::TextPlain; }
+    std::size_t content_size() const { return message.size(); }
+};
+static_assert(SizedContentConcept<RejectionResponse>);
+
+Server::Server(uint16_t port): port{port}, state{std::make_shared<ServerState>()} {}
+
 Server& Server::set_routes(std::vector<WebPoint> new_routes) {
+    if(!routes)
+        routes = std::make_shared<Router>();
     for(const WebPoint& route : new_routes)
-        routes[route] = route.function;
+        routes->add(route.type, route.address, route.function);
     return *this;
 }
 
@@ -47,42 +106,113 @@ Server& Server::set_threads(uint32_t count) {
     return *this;
 }
 
+Server& Server::set_thread_mode(ThreadMode mode, bool pin_to_cpus) {
+    thread_mode = mode;
+    pin_threads = pin_to_cpus;
+    return *this;
+}
+
+Server& Server::set_max_request_size(std::size_t bytes) {
+    max_request_size = bytes;
+    return *this;
+}
+
+BufferPoolStats Server::buffer_pool_stats() {
+    return BufferPool::stats();
+}
+
+TlsStats Server::tls_stats() {
+    return TlsContext::stats();
+}
+
 Server& Server::set_static_files(std::string directory, std::filesystem::path static_path) {
     this->static_path = std::move(static_path);
     static_dir = std::move(directory);
     return *this;
 }
 
+Server& Server::set_static_cache(std::size_t byte_budget) {
+    static_cache = byte_budget > 0 ? std::make_shared<StaticFileCache>(byte_budget) : nullptr;
+    return *this;
+}
+
+Server& Server::set_compression(std::size_t min_size) {
+    compression_min_size = min_size;
+    return *this;
+}
+
+Server& Server::set_metrics(std::string path) {
+    metrics_path = std::move(path);
+    return *this;
+}
+
+Server& Server::set_access_log(const std::filesystem::path& file, AccessLogFormat format) {
+    access_log = std::make_shared<AccessLog>(file, format);
+    return *this;
+}
+
+std::size_t Server::access_log_dropped() const {
+    return access_log ? access_log->dropped() : 0;
+}
+
+Server& Server::stop_on_signals() {
+    stop_signals = true;
+    return *this;
+}
+
 Server& Server::use_https(std::string key_path, std::string private_path) {
-    ssl_config = SslConfig{std::move(key_path), std::move(private_path)};
+    SslConfig config;
+    config.cert_path = std::move(key_path);
+    config.private_key = std::move(private_path);
+    ssl_config = std::move(config);
     return *this;
 }
 
-// Fake const here, beware
-class FileResponse : public OkResponse{
-    ContentType type;
-    std::size_t file_size;
-    mutable std::ifstream file;
-public:
-    FileResponse(ContentType type, const std::filesystem::path& path): type{type}, file{path, std::ios::ate | std::ios::binary}{
-        file_size = file.tellg();
-        file.seekg(0, std::ios::beg);
-    }
-    ContentType content_type() const { return type; }
-    std::size_t content_size() const { return file_size; }
-    void print_content(std::stringstream& s) const {
-        s << file.rdbuf();
-        file.seekg(0, std::ios::beg); // Preserve fake constness
+Server& Server::use_https(SslConfig config) {
+    ssl_config = std::move(config);
+    return *this;
+}
+
+Server& Server::add_listener(Listener listener) {
+    listeners.push_back(std::move(listener));
+    return *this;
+}
+
+FileResponse::FileResponse(ContentType type, const std::filesystem::path& path, Encoding encoding): type{type}, encoding{encoding} {
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if(fd >= 0 && ::fstat(fd, &info) == 0 && S_ISREG(info.st_mode)){
+        file_size = static_cast<std::size_t>(info.st_size);
+    }else if(fd >= 0){
+        ::close(fd);
+        fd = -1;
     }
-};
-static_assert( SizedContentConcept<FileResponse> );
+}
+
+FileResponse::FileResponse(FileResponse&& other) noexcept
+    : fd{std::exchange(other.fd, -1)}, file_size{other.file_size}, type{other.type}, encoding{other.encoding} {}
+
+FileResponse::~FileResponse() {
+    if(fd >= 0)
+        ::close(fd);
+}
 
 template<typename T>
 [[nodiscard]] asio::awaitable<void> fire_handler(const Server& server, const Request& request, HttpProtocol<T>& http) {
+    if(!server.metrics_path.empty() && request.url == server.metrics_path && request.type == RequestType::GET){
+        http.route_label = server.metrics_path;
+        return http.send(MetricsResponse{});
+    }
     if(request.url.starts_with(server.static_dir)){
         if(request.url.contains("..")){
             return http.send(StringResponse{404, ERROR_404});
         }
+        if(server.static_cache){
+            if(auto cached = server.static_cache->find(request.url)){
+                http.route_label = "static";
+                return http.send_cached(std::move(cached));
+            }
+        }
         auto path = server.static_path / request.url.substr(server.static_dir.size());
         
         ContentType type; // Default for safety
@@ -97,71 +227,523 @@ template<typename T>
                 type = from_file_extension(request.url.substr(pos));
         }
 
-        if(std::filesystem::exists(path)){
-            return http.send(FileResponse{type, path});
+        if(server.static_cache){
+            if(auto cached = server.static_cache->load(request.url, path, type)){
+                http.route_label = "static";
+                return http.send_cached(std::move(cached));
+            }
+        }
+        for(auto [encoding, extension] : {std::pair{Encoding::Brotli, ".br"}, std::pair{Encoding::Gzip, ".gz"}}){
+            if(!has(http.accepted_encoding(), encoding))
+                continue;
+            FileResponse sibling{type, path.string() + extension, encoding}; // Precompressed variant next to the file
+            if(sibling.is_open()){
+                http.route_label = "static";
+                return http.send(std::move(sibling));
+            }
+        }
+        FileResponse file{type, path};
+        if(file.is_open()){
+            http.route_label = "static";
+            return http.send(std::move(file));
         }
     }
 
-    auto it = server.routes.find({request.type, request.url});
-    if(it == server.routes.end()){
-        return http.send(StringResponse{404, ERROR_404});
+    if(server.static_routes){
+        if(auto handler = server.static_routes(request.type, request.url)){
+            http.route_label = request.url; // Static routes only match their exact pattern
+            return handler(http, request.param);
+        }
+    }
+    std::uint16_t allowed = 0;
+    if(server.routes){
+        auto match = http.route(*server.routes, request);
+        if(match.handler != nullptr){
+            http.route_label = match.pattern;
+            return match.handler(http, request.param);
+        }
+        allowed = match.method_not_allowed ? match.allowed_methods : 0;
     }
-    const WebPoint::Handler handler = it->second;
-    return handler(http, request.param);
+    if(server.static_routes)
+        allowed |= server.static_allowed(request.url); // Only on a miss, it looks the url up once per method
+    if(allowed != 0)
+        return http.send(MethodNotAllowedResponse{allowed});
+    return http.send(StringResponse{404, ERROR_404});
 }
 
 template<Connection ConnectionType>
-void handle_connection(const Server& server, ConnectionType connection){
-    asio::co_spawn(connection.get_executor(), [&, http = HttpProtocol<ConnectionType>{std::move(connection)}]() mutable -> asio::awaitable<void> {
-        char read[1024*4096]; // Max request size set to 4MB
+void handle_connection(const Server& server, ConnectionRegistry& registry, ConnectionType connection){
+    auto http = std::make_shared<HttpProtocol<ConnectionType>>(std::move(connection), server);
+    if(!registry.add(http))
+        http->drain(); // Accepted while the server started stopping
+    asio::co_spawn(http->get_executor(), [&server, &registry, http]() -> asio::awaitable<void> {
+        struct Unregister{
+            ConnectionRegistry& registry;
+            Drainable* connection;
+            ~Unregister(){ registry.remove(connection); }
+        } unregister{registry, http.get()};
+        for(const auto& mid : server.middlewares)
+            mid->on_connection_open(http->connection_info());
+        std::optional<HttpError> error;
         try{
-            co_await http.init();
+            co_await http->init();
             do{
-                http.set_buffer(read);
-                Request request = co_await http.parse_request();
-                co_await http.receive_headers();
+                co_await http->parse_request();
                 for(const auto& mid : server.middlewares)
-                    mid->on_received(request);
-                co_await fire_handler(server, request, http);
-            } while(http.connection_keepalive > std::time(nullptr));
+                    mid->on_received(http->request());
+                std::optional<Rejection> rejection;
+                for(auto it = server.middlewares.begin(); it != server.middlewares.end() && !rejection; ++it)
+                    rejection = (*it)->before_handler(*http);
+                if(rejection){
+                    http->route_label = "rejected";
+                    co_await http->send(RejectionResponse{*rejection});
+                }else{
+                    co_await fire_handler(server, http->request(), *http);
+                }
+                co_await http->discard_body();
+
+                auto info = http->response_info();
+                http->record_request(info);
+                for(const auto& mid : server.middlewares)
+                    mid->after_response(*http, info);
+                if(server.access_log)
+                    server.access_log->record(*http, info);
+                http->finish_request();
+            } while(http->keep_alive);
+        }
+        catch(const HttpError& e){
+            error = e;
         }
         catch(std::exception& e){
             // std::cout << e.what() << std::endl;
         }
-        co_await http.close();
+        if(error && http->can_send_error()){
+            try{
+                http->keep_alive = false;
+                if(http->route_label.empty())
+                    http->route_label = "invalid"; // Rejected before routing
+                auto message = std::to_string(error->status()) + " " + error->what();
+                co_await http->send(StringResponse{error->status(), message});
+                auto info = http->response_info();
+                http->record_request(info);
+                for(const auto& mid : server.middlewares)
+                    mid->after_response(*http, info);
+                if(server.access_log)
+                    server.access_log->record(*http, info);
+            }
+            catch(std::exception&){}
+        }
+        co_await http->close();
+        for(const auto& mid : server.middlewares)
+            mid->on_connection_close(http->connection_info());
     }, asio::detached);
 }
 
-void Server::run() const{
-    asio::io_context context(thread_count);
+using reuse_port = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
+// Listening sockets handed over through LISTEN_FDS, by the address they are bound to
+using InheritedListeners = std::map<tcp::endpoint, std::vector<int>>;
+
+constexpr int first_listen_fd = 3; // SD_LISTEN_FDS_START
+
+// How long hand_over waits for the new process to report it serves the sockets
+constexpr auto handover_timeout = std::chrono::seconds(30);
+
+// The pipe hand_over waits on, passed next to the listening sockets
+static int handover_ready_fd(){
+    const char* pid = std::getenv("LISTEN_PID");
+    const char* ready = std::getenv("HTPP_READY_FD");
+    if(pid == nullptr || ready == nullptr)
+        return -1;
+    long listen_pid = 0;
+    int fd = -1;
+    std::from_chars(pid, pid + std::strlen(pid), listen_pid);
+    std::from_chars(ready, ready + std::strlen(ready), fd);
+    unsetenv("HTPP_READY_FD");
+    if(listen_pid != getpid() || fd < first_listen_fd)
+        return -1;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+// One byte and then EOF tells the old process it can stop
+static void notify_ready(int fd){
+    if(fd < 0)
+        return;
+    char ready = 1;
+    while(write(fd, &ready, 1) < 0 && errno == EINTR){}
+    close(fd);
+}
+
+// Picks up sockets from systemd socket activation or Server::hand_over, only when they were meant for this process
+static InheritedListeners inherited_listeners(){
+    InheritedListeners listeners;
+    const char* pid = std::getenv("LISTEN_PID");
+    const char* fds = std::getenv("LISTEN_FDS");
+    if(pid == nullptr || fds == nullptr)
+        return listeners;
+    long listen_pid = 0;
+    int count = 0;
+    std::from_chars(pid, pid + std::strlen(pid), listen_pid);
+    std::from_chars(fds, fds + std::strlen(fds), count);
+    if(listen_pid != getpid())
+        return listeners;
+    unsetenv("LISTEN_PID"); // Not for our children
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+
+    for(int fd = first_listen_fd; fd < first_listen_fd + count; fd++){
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        sockaddr_storage address{};
+        socklen_t length = sizeof(address);
+        if(getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length) != 0)
+            continue;
+        if(address.ss_family != AF_INET && address.ss_family != AF_INET6)
+            continue;
+        tcp::endpoint endpoint;
+        std::memcpy(endpoint.data(), &address, length);
+        listeners[endpoint].push_back(fd);
+    }
+    return listeners;
+}
+
+static tcp::endpoint listener_endpoint(const Listener& listener){
+    asio::error_code ec;
+    auto address = asio::ip::make_address(listener.address, ec);
+    if(ec)
+        throw std::runtime_error{"Invalid listen address " + listener.address};
+    return {address, listener.port};
+}
+
+// A dual-stack listener that fell back to IPv4 is inherited as 0.0.0.0
+static InheritedListeners::iterator find_inherited(InheritedListeners& inherited, const tcp::endpoint& endpoint){
+    auto found = inherited.find(endpoint);
+    if(found == inherited.end() && endpoint.address() == asio::ip::address_v6::any())
+        found = inherited.find({asio::ip::address_v4::any(), endpoint.port()});
+    return found;
+}
+
+template<int Option>
+static void set_tcp_option(tcp::acceptor& accepter, int value){
+    if(setsockopt(accepter.native_handle(), IPPROTO_TCP, Option, &value, sizeof(value)) != 0)
+        throw std::system_error{errno, std::generic_category(), "Can't configure listener"};
+}
+
+// With SO_REUSEPORT every shard binds its own acceptor and the kernel spreads connections across them
+static std::shared_ptr<tcp::acceptor> bind_listener(asio::io_context& context, const Listener& listener, tcp::endpoint endpoint, bool shared_port){
+    auto accepter = std::make_shared<tcp::acceptor>(context);
+    asio::error_code ec;
+    accepter->open(endpoint.protocol(), ec);
+    if(ec == asio::error::address_family_not_supported && endpoint.address() == asio::ip::address_v6::any()){
+        endpoint = {asio::ip::address_v4::any(), endpoint.port()}; // IPv6 is disabled on this host
+        accepter->open(endpoint.protocol());
+    }else if(ec){
+        throw asio::system_error{ec};
+    }
+    accepter->set_option(tcp::acceptor::reuse_address(true));
+    if(shared_port)
+        accepter->set_option(reuse_port(true));
+    if(endpoint.protocol() == tcp::v6())
+        accepter->set_option(asio::ip::v6_only(listener.v6_only));
+    if(listener.fast_open > 0)
+        set_tcp_option<TCP_FASTOPEN>(*accepter, listener.fast_open);
+    if(listener.defer_accept.count() > 0)
+        set_tcp_option<TCP_DEFER_ACCEPT>(*accepter, static_cast<int>(listener.defer_accept.count()));
+    accepter->bind(endpoint);
+    accepter->listen(listener.backlog);
+    return accepter;
+}
+
+// Inherited sockets keep the options whoever created them chose. Acceptors beyond them share a duplicate of one
+static std::shared_ptr<tcp::acceptor> adopt_listener(asio::io_context& context, const tcp::endpoint& endpoint, const std::vector<int>& inherited, std::size_t index){
+    auto fd = inherited[index % inherited.size()];
+    if(index >= inherited.size()){
+        fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if(fd < 0)
+            throw std::system_error{errno, std::generic_category(), "Can't duplicate inherited listener"};
+    }
+    return std::make_shared<tcp::acceptor>(context, endpoint.protocol(), fd);
+}
 
-    asio::co_spawn(context, [&]() mutable -> asio::awaitable<void> {
-        tcp::acceptor accepter{context, tcp::endpoint{tcp::v4(), port}};
-        while(true){
-            auto socket = co_await accepter.async_accept(asio::use_awaitable);
-            handle_connection(*this, SimpleConnection{std::move(socket)});
+// Accepts until stop() closes the acceptor
+template<typename MakeConnection>
+void spawn_acceptor(const Server& server, ConnectionRegistry& registry, std::shared_ptr<tcp::acceptor> accepter, bool no_delay, MakeConnection make_connection){
+    asio::co_spawn(accepter->get_executor(), [&server, &registry, accepter, no_delay, make_connection]() mutable -> asio::awaitable<void> {
+        asio::steady_timer backoff{accepter->get_executor()};
+        while(accepter->is_open()){
+            asio::error_code ec;
+            auto socket = co_await accepter->async_accept(asio::redirect_error(asio::use_awaitable, ec));
+            if(ec){
+                if(accepter->is_open()){ // Out of descriptors or similar, give closing connections a moment
+                    backoff.expires_after(std::chrono::milliseconds(10));
+                    co_await backoff.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+                }
+                continue;
+            }
+            if(no_delay)
+                socket.set_option(tcp::no_delay{true}, ec); // Responses leave whole, Nagle would only hold back their last segment
+            handle_connection(server, registry, make_connection(std::move(socket)));
         }
     }, asio::detached);
+}
 
-    
-    asio::ssl::context ssl_ctx{asio::ssl::context::tls_server};
-    if(ssl_config.has_value()){
-        ssl_ctx.use_certificate_file(ssl_config->cert_path, asio::ssl::context_base::pem);
-        ssl_ctx.use_private_key_file(ssl_config->private_key, asio::ssl::context_base::pem);
-        ssl_ctx.set_verify_mode(asio::ssl::verify_none);
-
-        asio::co_spawn(context, [&]() mutable -> asio::awaitable<void> {
-            tcp::acceptor accepter{context, tcp::endpoint{tcp::v4(), 443}};
-            while(true){
-                auto socket = co_await accepter.async_accept(asio::use_awaitable);
-                handle_connection(*this, SslConnection{std::move(socket), ssl_ctx});
-            }
-        }, asio::detached);
+// Closes the acceptors and drains every connection, the contexts stop once all are gone or the grace period is over
+static asio::awaitable<void> drain_server(std::shared_ptr<ServerState> state, std::chrono::steady_clock::duration grace){
+    for(const auto& accepter : state->acceptors){
+        asio::post(accepter->get_executor(), [accepter]{
+            asio::error_code ec;
+            accepter->close(ec);
+        });
+    }
+    for(const auto& registry : state->registries)
+        registry->drain_all();
+
+    auto open_connections = [&state]{
+        std::size_t open = 0;
+        for(const auto& registry : state->registries)
+            open += registry->size();
+        return open;
+    };
+    asio::steady_timer timer{co_await asio::this_coro::executor};
+    auto deadline = std::chrono::steady_clock::now() + grace;
+    for(bool aborted = false;; ){
+        while(open_connections() > 0 && std::chrono::steady_clock::now() < deadline){
+            timer.expires_after(std::chrono::milliseconds(10));
+            co_await timer.async_wait(asio::use_awaitable);
+        }
+        if(open_connections() == 0 || aborted)
+            break;
+        for(const auto& registry : state->registries)
+            registry->abort_all();
+        aborted = true;
+        deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1); // Cancelled connections still close their sockets
+    }
+    for(auto* context : state->contexts)
+        context->stop();
+}
+
+void Server::stop(std::chrono::steady_clock::duration grace) const{
+    auto guard = std::lock_guard{state->lock};
+    if(state->stopping)
+        return;
+    state->stopping = true;
+    if(!state->contexts.empty())
+        asio::co_spawn(*state->contexts.front(), drain_server(state, grace), asio::detached);
+}
+
+void Server::hand_over(const std::vector<std::string>& command, std::chrono::steady_clock::duration grace) const{
+    std::vector<int> fds;
+    {
+        auto guard = std::lock_guard{state->lock};
+        if(!state->stopping)
+            for(const auto& accepter : state->acceptors)
+                fds.push_back(accepter->native_handle());
+    }
+    if(command.empty() || fds.empty())
+        throw std::runtime_error{"hand_over needs a command and a running server"};
+
+    // Everything the child needs is allocated before forking, it may only make async signal safe calls
+    std::vector<char*> arguments;
+    for(const auto& argument : command)
+        arguments.push_back(const_cast<char*>(argument.c_str()));
+    arguments.push_back(nullptr);
+    std::vector<std::string> variables;
+    for(char** variable = environ; *variable != nullptr; variable++)
+        if(!std::string_view{*variable}.starts_with("LISTEN_") && !std::string_view{*variable}.starts_with("HTPP_READY_FD="))
+            variables.emplace_back(*variable);
+    variables.push_back("LISTEN_FDS=" + std::to_string(fds.size()));
+    variables.push_back("HTPP_READY_FD=" + std::to_string(first_listen_fd + fds.size()));
+    constexpr std::string_view pid_prefix{"LISTEN_PID="};
+    std::array<char, 32> listen_pid{};
+    std::copy(pid_prefix.begin(), pid_prefix.end(), listen_pid.begin());
+    std::vector<char*> environment;
+    for(auto& variable : variables)
+        environment.push_back(variable.data());
+    environment.push_back(listen_pid.data());
+    environment.push_back(nullptr);
+    auto count = static_cast<int>(fds.size());
+    auto max_fd = static_cast<int>(sysconf(_SC_OPEN_MAX));
+
+    // The child writes errno if exec fails, the new process writes one byte once it serves the sockets.
+    // EOF without either means it died on the way.
+    int ready[2];
+    if(pipe2(ready, O_CLOEXEC) != 0)
+        throw std::system_error{errno, std::generic_category(), "pipe"};
+    auto child = fork();
+    if(child < 0){
+        auto error = errno;
+        close(ready[0]);
+        close(ready[1]);
+        throw std::system_error{error, std::generic_category(), "fork"};
+    }
+    if(child == 0){
+        auto ready_fd = first_listen_fd + count;
+        for(auto& fd : fds) // Out of the way of the range they move to
+            fd = fcntl(fd, F_DUPFD, ready_fd + 1);
+        ready[1] = fcntl(ready[1], F_DUPFD, ready_fd + 1);
+        for(int i = 0; i < count; i++)
+            dup2(fds[static_cast<std::size_t>(i)], first_listen_fd + i); // Duplicates don't inherit close on exec
+        dup2(ready[1], ready_fd);
+        if(close_range(static_cast<unsigned>(ready_fd + 1), ~0u, 0) != 0)
+            for(int fd = ready_fd + 1; fd < max_fd; fd++)
+                close(fd);
+
+        char digits[16];
+        int length = 0;
+        for(auto pid = getpid(); length == 0 || pid > 0; pid /= 10)
+            digits[length++] = static_cast<char>('0' + pid % 10);
+        for(auto* out = listen_pid.data() + pid_prefix.size(); length > 0; )
+            *out++ = digits[--length];
+
+        execve(arguments.front(), arguments.data(), environment.data());
+        int error = errno;
+        while(write(ready_fd, &error, sizeof(error)) < 0 && errno == EINTR){}
+        _exit(127);
+    }
+    close(ready[1]);
+
+    std::array<char, sizeof(int)> message;
+    std::size_t received = 0;
+    auto deadline = std::chrono::steady_clock::now() + handover_timeout;
+    bool timed_out = false;
+    while(received < message.size()){
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        pollfd readable{ready[0], POLLIN, 0};
+        auto polled = left.count() > 0 ? poll(&readable, 1, static_cast<int>(left.count())) : 0;
+        if(polled == 0){
+            timed_out = true;
+            break;
+        }
+        auto length = polled < 0 ? -1 : read(ready[0], message.data() + received, message.size() - received);
+        if(length < 0 && errno == EINTR)
+            continue;
+        if(length <= 0)
+            break;
+        received += static_cast<std::size_t>(length);
+    }
+    close(ready[0]);
+    if(received == 1 && !timed_out){
+        stop(grace);
+        return;
+    }
+
+    // Keeps serving, the sockets are still ours
+    if(timed_out)
+        kill(child, SIGKILL);
+    waitpid(child, nullptr, 0);
+    if(received == message.size()){
+        int error;
+        std::memcpy(&error, message.data(), sizeof(error));
+        throw std::system_error{error, std::generic_category(), "hand_over couldn't start " + command.front()};
+    }
+    throw std::runtime_error{timed_out ? "hand_over: " + command.front() + " didn't get ready in time"
+                                       : "hand_over: " + command.front() + " exited before it was ready"};
+}
+
+static void pin_to_cpu(std::size_t index){
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(index % std::max(1u, std::thread::hardware_concurrency()), &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+}
+
+void Server::run() const{
+    bool sharded = thread_mode == ThreadMode::Sharded && thread_count > 1;
+    std::vector<std::unique_ptr<asio::io_context>> contexts;
+    for(auto i = 0u; i < (sharded ? thread_count : 1u); i++)
+        contexts.push_back(std::make_unique<asio::io_context>(sharded ? 1 : static_cast<int>(thread_count)));
+    asio::co_spawn(*contexts.front(), DateCache::run(), asio::detached);
+
+    std::optional<TlsContext> tls;
+    if(ssl_config.has_value())
+        tls.emplace(*ssl_config);
+
+    std::vector<std::unique_ptr<ConnectionRegistry>> registries;
+    for(std::size_t i = 0; i < contexts.size(); i++)
+        registries.push_back(std::make_unique<ConnectionRegistry>());
+    std::vector<std::shared_ptr<tcp::acceptor>> acceptors;
+    auto ready_fd = handover_ready_fd();
+    auto inherited = inherited_listeners();
+    auto listen = [&](const Listener& listener, auto make_connection){
+        auto endpoint = listener_endpoint(listener);
+        auto sockets = find_inherited(inherited, endpoint);
+        auto count = sockets == inherited.end() ? contexts.size() : std::max(contexts.size(), sockets->second.size());
+        for(std::size_t i = 0; i < count; i++){
+            auto& context = *contexts[i % contexts.size()];
+            auto accepter = sockets == inherited.end() ? bind_listener(context, listener, endpoint, sharded)
+                                                       : adopt_listener(context, sockets->first, sockets->second, i);
+            spawn_acceptor(*this, *registries[i % contexts.size()], accepter, listener.no_delay, make_connection);
+            acceptors.push_back(std::move(accepter));
+        }
+        if(sockets != inherited.end())
+            inherited.erase(sockets);
+    };
+    auto configured = listeners;
+    if(configured.empty()){
+        configured.push_back(Listener{.port = port});
+        if(ssl_config.has_value())
+            configured.push_back(Listener{.port = 443, .tls = true});
+    }
+    for(const auto& listener : configured){
+        if(!listener.tls){
+            listen(listener, [](tcp::socket socket){
+                return SimpleConnection{std::move(socket)};
+            });
+        }else if(tls.has_value()){
+            listen(listener, [&tls](tcp::socket socket){
+                return SslConnection{std::move(socket), tls->native()};
+            });
+        }else{
+            throw std::runtime_error{"TLS listener on port " + std::to_string(listener.port) + " without use_https()"};
+        }
     }
+    for(const auto& [unused_endpoint, sockets] : inherited)
+        for(auto fd : sockets)
+            close(fd);
+
+    std::optional<asio::signal_set> signals;
+    if(stop_signals){
+        signals.emplace(*contexts.front(), SIGINT, SIGTERM);
+        signals->async_wait([this](const asio::error_code& ec, int){
+            if(!ec)
+                stop();
+        });
+    }
+
+    {
+        auto guard = std::lock_guard{state->lock};
+        if(state->stopping)
+            return;
+        for(const auto& context : contexts)
+            state->contexts.push_back(context.get());
+        state->acceptors = std::move(acceptors);
+        state->registries = std::move(registries);
+    }
+    notify_ready(ready_fd);
 
     std::vector<std::jthread> threads;
-    for(auto i = 1u; i < thread_count; i++)
-        threads.emplace_back([&](){context.run();});
+    for(auto i = 1u; i < thread_count; i++){
+        auto& context = *contexts[sharded ? i : 0];
+        threads.emplace_back([&context, i, this](){
+            if(pin_threads)
+                pin_to_cpu(i);
+            context.run();
+        });
+    }
+
+    if(pin_threads)
+        pin_to_cpu(0);
+    contexts.front()->run();
 
-    context.run();
-}
\ No newline at end of file
+    // Stopped, connection coroutines still unregister themselves when the contexts destroy them
+    threads.clear();
+    signals.reset();
+    {
+        auto guard = std::lock_guard{state->lock};
+        state->contexts.clear();
+        state->acceptors.clear();
+    }
+    contexts.clear();
+    auto guard = std::lock_guard{state->lock};
+    state->registries.clear();
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <asio.hpp>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace htpp{
+    // Implemented by connections so a stopping server can reach them, both calls are safe from any thread
+    class Drainable{
+    public:
+        virtual void drain() = 0; // Idle connections close at once, busy ones after the response they are working on
+        virtual void abort() = 0; // The drain deadline passed, cancel whatever the connection waits on
+    protected:
+        ~Drainable() = default;
+    };
+
+    // Live connections of one io_context
+    class ConnectionRegistry{
+        std::mutex lock;
+        std::unordered_map<Drainable*, std::weak_ptr<Drainable>> connections;
+        bool draining{false};
+
+        template<typename F>
+        void for_each(F&& f){
+            std::vector<std::shared_ptr<Drainable>> live;
+            {
+                auto guard = std::lock_guard{lock};
+                for(const auto& [key, connection] : connections)
+                    if(auto locked = connection.lock())
+                        live.push_back(std::move(locked));
+            }
+            for(const auto& connection : live)
+                f(*connection);
+        }
+
+    public:
+        // False once the registry drains, the connection has to drain itself
+        bool add(const std::shared_ptr<Drainable>& connection){
+            auto guard = std::lock_guard{lock};
+            connections.emplace(connection.get(), connection);
+            return !draining;
+        }
+
+        void remove(Drainable* connection){
+            auto guard = std::lock_guard{lock};
+            connections.erase(connection);
+        }
+
+        std::size_t size(){
+            auto guard = std::lock_guard{lock};
+            return connections.size();
+        }
+
+        void drain_all(){
+            {
+                auto guard = std::lock_guard{lock};
+                draining = true;
+            }
+            for_each([](Drainable& connection){ connection.drain(); });
+        }
+
+        void abort_all(){
+            for_each([](Drainable& connection){ connection.abort(); });
+        }
+    };
+
+    // What Server::run() shares with stop() while it runs
+    class ServerState{
+    public:
+        std::mutex lock;
+        bool stopping{false};
+        std::vector<asio::io_context*> contexts;
+        std::vector<std::shared_ptr<asio::ip::tcp::acceptor>> acceptors;
+        std::vector<std::unique_ptr<ConnectionRegistry>> registries; // One per context
+    };
+}
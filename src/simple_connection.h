@@ -1,9 +1,24 @@
 #pragma once
 #include <asio.hpp>
 #include <iostream>
+#include <span>
+#include <vector>
+#include <system_error>
+
+#include <sys/sendfile.h>
+#include <sys/socket.h>
 
 class SimpleConnection {
     asio::ip::tcp::socket socket;
+    std::size_t sent{0};
+
+    // Counts bytes as each partial write completes, not only when the whole write finishes
+    auto count_sent(){
+        return [this, base = sent](const asio::error_code& ec, std::size_t transferred){
+            sent = base + transferred;
+            return asio::transfer_all()(ec, transferred);
+        };
+    }
 public:
     SimpleConnection(asio::ip::tcp::socket socket): socket{std::move(socket)} {}
     SimpleConnection(const SimpleConnection&) = delete;
@@ -11,15 +26,56 @@ public:
     SimpleConnection(SimpleConnection&&) noexcept = default;
     SimpleConnection& operator=(SimpleConnection&&) noexcept = default;
 
+    static constexpr bool secure = false;
+
     [[nodiscard]] asio::awaitable<void> init(){ co_return; }
+    asio::ip::tcp::endpoint remote_endpoint() const {
+        asio::error_code ec;
+        return socket.remote_endpoint(ec);
+    }
+    [[nodiscard]] asio::awaitable<void> wait_readable(){
+        return socket.async_wait(asio::ip::tcp::socket::wait_read, asio::use_awaitable);
+    }
     [[nodiscard]] asio::awaitable<std::size_t> receive(asio::mutable_buffer buffer) {
         return socket.async_receive(buffer, asio::use_awaitable);
     }
     [[nodiscard]] asio::awaitable<size_t> write(asio::const_buffer data) {
-        return asio::async_write(socket, data, asio::use_awaitable);
+        return asio::async_write(socket, data, count_sent(), asio::use_awaitable);
     }
-    std::size_t available(){
-        return socket.available();
+    [[nodiscard]] asio::awaitable<size_t> write(std::span<const asio::const_buffer> data) {
+        return asio::async_write(socket, data, count_sent(), asio::use_awaitable);
+    }
+    // Bytes handed to the kernel so far
+    std::size_t written() const {
+        return sent;
+    }
+    // Headers go out with MSG_MORE so they share a segment with the start of the file
+    [[nodiscard]] asio::awaitable<void> write_file(std::span<const asio::const_buffer> headers, int fd, std::size_t size) {
+        socket.native_non_blocking(true);
+        std::vector<asio::const_buffer> pending{headers.begin(), headers.end()};
+        auto first = pending.begin();
+        while(first != pending.end()){
+            auto count = co_await socket.async_send(std::span{first, pending.end()}, MSG_MORE, asio::use_awaitable);
+            sent += count;
+            for(; first != pending.end() && count >= first->size(); ++first)
+                count -= first->size();
+            if(first != pending.end())
+                *first += count;
+        }
+        off_t offset = 0;
+        while(static_cast<std::size_t>(offset) < size){
+            auto count = ::sendfile(socket.native_handle(), fd, &offset, size - static_cast<std::size_t>(offset));
+            if(count > 0){
+                sent += static_cast<std::size_t>(count);
+                continue;
+            }
+            if(count == 0)
+                throw std::runtime_error{"File truncated while sending"};
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                co_await socket.async_wait(asio::ip::tcp::socket::wait_write, asio::use_awaitable);
+            else if(errno != EINTR)
+                throw std::system_error{errno, std::generic_category()};
+        }
     }
     [[nodiscard]] asio::any_io_executor get_executor() {
         return socket.get_executor();
@@ -27,11 +83,16 @@ public:
     bool is_open(){
         return socket.is_open();
     }
+    void cancel(){
+        asio::error_code ec;
+        socket.cancel(ec);
+    }
     [[nodiscard]] asio::awaitable<void> close(){
+        asio::error_code ec;
         if(socket.is_open()){
-            socket.shutdown(asio::ip::tcp::socket::shutdown_send);
+            socket.shutdown(asio::ip::tcp::socket::shutdown_send, ec);
         }
-        socket.close();
+        socket.close(ec);
         co_return;
     }
 };
\ No newline at end of file
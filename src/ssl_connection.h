@@ -1,11 +1,27 @@
 #pragma once
 #include <asio.hpp>
 #include <asio/ssl.hpp>
+#include "buffer_pool.h"
+#include "tls.h"
 
+#include <vector>
 #include <optional>
+#include <span>
+#include <system_error>
+
+#include <unistd.h>
 
 class SslConnection {
     asio::ssl::stream<asio::ip::tcp::socket> socket;
+    std::size_t sent{0};
+
+    // Counts plaintext bytes as each partial write completes, not only when the whole write finishes
+    auto count_sent(){
+        return [this, base = sent](const asio::error_code& ec, std::size_t transferred){
+            sent = base + transferred;
+            return asio::transfer_all()(ec, transferred);
+        };
+    }
 public: 
     SslConnection(asio::ip::tcp::socket socket, asio::ssl::context& ctx): socket{std::move(socket), ctx} {}
     SslConnection(const SslConnection&) = delete;
@@ -13,17 +29,57 @@ public:
     SslConnection(SslConnection&&) noexcept = default;
     SslConnection& operator=(SslConnection&&) noexcept = default;
 
+    static constexpr bool secure = true;
+
+    asio::ip::tcp::endpoint remote_endpoint() const {
+        asio::error_code ec;
+        return socket.next_layer().remote_endpoint(ec);
+    }
     [[nodiscard]] asio::awaitable<void> init(){
-        return socket.async_handshake(asio::ssl::stream_base::server, asio::use_awaitable);
+        try{
+            co_await socket.async_handshake(asio::ssl::stream_base::server, asio::use_awaitable);
+        }
+        catch(asio::system_error&){
+            htpp::TlsContext::handshake_failed();
+            throw;
+        }
+        htpp::TlsContext::handshake_done(socket.native_handle());
+    }
+    [[nodiscard]] asio::awaitable<void> wait_readable(){
+        co_return; // The TLS engine may already hold decrypted bytes, the first receive does the waiting
     }
     [[nodiscard]] asio::awaitable<std::size_t> receive(asio::mutable_buffer buffer) {
         return socket.async_read_some(buffer, asio::use_awaitable);
     }
     [[nodiscard]] asio::awaitable<size_t> write(asio::const_buffer data) {
-        return asio::async_write(socket, data, asio::use_awaitable);
+        return asio::async_write(socket, data, count_sent(), asio::use_awaitable);
+    }
+    [[nodiscard]] asio::awaitable<size_t> write(std::span<const asio::const_buffer> data) {
+        return asio::async_write(socket, data, count_sent(), asio::use_awaitable);
     }
-    std::size_t available(){
-        return socket.lowest_layer().available();
+    // Plaintext bytes handed to the TLS engine and written so far
+    std::size_t written() const {
+        return sent;
+    }
+    // Encryption happens in user space, so stream the file through a single pooled block
+    [[nodiscard]] asio::awaitable<void> write_file(std::span<const asio::const_buffer> headers, int fd, std::size_t size) {
+        std::vector<asio::const_buffer> buffers{headers.begin(), headers.end()};
+        RequestBuffer block{BufferPool::block_size};
+        block.acquire();
+        off_t offset = 0;
+        do{
+            auto count = ::pread(fd, block.data(), std::min(block.size(), size - static_cast<std::size_t>(offset)), offset);
+            if(count < 0 && errno == EINTR)
+                continue;
+            if(count < 0)
+                throw std::system_error{errno, std::generic_category()};
+            if(count == 0 && static_cast<std::size_t>(offset) < size)
+                throw std::runtime_error{"File truncated while sending"};
+            offset += count;
+            buffers.emplace_back(block.data(), static_cast<std::size_t>(count));
+            co_await asio::async_write(socket, buffers, count_sent(), asio::use_awaitable);
+            buffers.clear();
+        } while(static_cast<std::size_t>(offset) < size);
     }
     asio::any_io_executor get_executor() {
         return socket.get_executor();
@@ -31,10 +87,15 @@ public:
     bool is_open(){
         return socket.lowest_layer().is_open();
     }
+    void cancel(){
+        asio::error_code ec;
+        socket.lowest_layer().cancel(ec);
+    }
     [[nodiscard]] asio::awaitable<void> close(){
+        asio::error_code ec;
         if(socket.lowest_layer().is_open()){
-            co_await socket.async_shutdown(asio::use_awaitable);
+            co_await socket.async_shutdown(asio::redirect_error(asio::use_awaitable, ec));
         }
-        socket.lowest_layer().close();
+        socket.lowest_layer().close(ec);
     }
 };
\ No newline at end of file
@@ -0,0 +1,198 @@
+#pragma once
+#include <htpp/http.h>
+#include "compression.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace htpp{
+    struct CachedFile{
+        struct Variant{
+            std::string headers; // Content headers including the blank line ending the head
+            std::string body;
+        };
+        Variant plain;
+        std::optional<Variant> gzip;
+        std::optional<Variant> brotli;
+
+        const Variant& select(Encoding accepted) const {
+            if(brotli && has(accepted, Encoding::Brotli))
+                return *brotli;
+            if(gzip && has(accepted, Encoding::Gzip))
+                return *gzip;
+            return plain;
+        }
+
+        std::size_t size() const {
+            return plain.body.size() + (gzip ? gzip->body.size() : 0) + (brotli ? brotli->body.size() : 0);
+        }
+    };
+
+    // Byte bounded cache of small static files, split into shards by url so threads mostly take different locks.
+    // Hits only take their shard's lock shared and stamp the entry, a load evicts the entries used longest ago.
+    // Entries are revalidated against their mtime at most once per second
+    class StaticFileCache{
+        using Clock = std::chrono::steady_clock;
+        static constexpr auto revalidate_interval = std::chrono::duration_cast<Clock::duration>(std::chrono::seconds(1)).count();
+        static constexpr std::size_t shard_count = 8;
+
+        struct StringHash{
+            using is_transparent = void;
+            std::size_t operator()(std::string_view str) const noexcept { return std::hash<std::string_view>{}(str); }
+        };
+
+        struct Entry{
+            std::shared_ptr<const CachedFile> file;
+            std::filesystem::path path;
+            std::filesystem::file_time_type modified;
+            std::atomic<Clock::rep> checked;
+            std::atomic<Clock::rep> last_used;
+
+            Entry(std::shared_ptr<const CachedFile> file, std::filesystem::path path, std::filesystem::file_time_type modified, Clock::rep now):
+                file{std::move(file)}, path{std::move(path)}, modified{modified}, checked{now}, last_used{now} {}
+        };
+
+        struct Shard{
+            std::shared_mutex lock;
+            std::size_t used{0};
+            std::unordered_map<std::string, Entry, StringHash, std::equal_to<>> entries;
+            std::unordered_set<std::string, StringHash, std::equal_to<>> loading; // Urls a request is reading and compressing
+        };
+
+        std::size_t shard_budget;
+        std::array<Shard, shard_count> shards;
+
+        Shard& shard_of(std::string_view url){
+            return shards[StringHash{}(url) % shard_count];
+        }
+
+        static void erase(Shard& shard, decltype(Shard::entries)::iterator it){
+            shard.used -= it->second.file->size();
+            shard.entries.erase(it);
+        }
+
+        // Returns nullptr when the file is missing or too large to cache
+        std::shared_ptr<const CachedFile> read(const std::filesystem::path& path, ContentType type, std::filesystem::file_time_type& modified) const {
+            std::error_code ec;
+            auto size = std::filesystem::file_size(path, ec);
+            if(ec || size > max_entry_size())
+                return nullptr;
+            modified = std::filesystem::last_write_time(path, ec);
+            if(ec)
+                return nullptr;
+
+            std::ifstream stream{path, std::ios::binary};
+            if(!stream)
+                return nullptr;
+            auto file = std::make_shared<CachedFile>();
+            auto& plain = file->plain;
+            plain.body.assign(std::istreambuf_iterator<char>{stream}, std::istreambuf_iterator<char>{});
+            plain.headers.append("Content-Type: ").append(to_str(type)).append("\r\n");
+            plain.headers.append("Content-Length: ").append(std::to_string(plain.body.size())).append("\r\n\r\n");
+
+            // Compressed once up front at high quality, hits then only pick a variant
+            if(is_compressible(type)){
+                for(auto encoding : {Encoding::Gzip, Encoding::Brotli}){
+                    auto body = compress(encoding, plain.body, true);
+                    if(body.empty() || body.size() >= plain.body.size())
+                        continue;
+                    auto& variant = (encoding == Encoding::Gzip ? file->gzip : file->brotli).emplace();
+                    variant.body = std::move(body);
+                    variant.headers.append("Content-Type: ").append(to_str(type)).append("\r\n");
+                    variant.headers.append("Content-Encoding: ").append(to_str(encoding)).append("\r\nVary: Accept-Encoding\r\n");
+                    variant.headers.append("Content-Length: ").append(std::to_string(variant.body.size())).append("\r\n\r\n");
+                }
+            }
+            return file;
+        }
+
+    public:
+        explicit StaticFileCache(std::size_t byte_budget): shard_budget{byte_budget / shard_count} {}
+
+        // Any entry fits its shard
+        std::size_t max_entry_size() const {
+            return std::min<std::size_t>(shard_budget, 1024 * 1024);
+        }
+
+        std::shared_ptr<const CachedFile> find(std::string_view url){
+            auto now = Clock::now().time_since_epoch().count();
+            auto& shard = shard_of(url);
+            std::shared_ptr<const CachedFile> file;
+            std::filesystem::path path;
+            std::filesystem::file_time_type modified;
+            {
+                auto guard = std::shared_lock{shard.lock};
+                auto it = shard.entries.find(url);
+                if(it == shard.entries.end())
+                    return nullptr;
+                auto& entry = it->second;
+                entry.last_used.store(now, std::memory_order_relaxed);
+                file = entry.file;
+                auto checked = entry.checked.load(std::memory_order_relaxed);
+                if(now - checked < revalidate_interval || !entry.checked.compare_exchange_strong(checked, now, std::memory_order_relaxed))
+                    return file; // Fresh, or another caller revalidates it and this one keeps the entry meanwhile
+                path = entry.path;
+                modified = entry.modified;
+            }
+
+            std::error_code ec;
+            if(std::filesystem::last_write_time(path, ec) == modified && !ec)
+                return file;
+
+            auto guard = std::unique_lock{shard.lock};
+            if(auto it = shard.entries.find(url); it != shard.entries.end() && it->second.file == file)
+                erase(shard, it);
+            return nullptr;
+        }
+
+        // Returns nullptr when the file is missing, too large to cache or already being loaded by another request,
+        // which then serves it from disk rather than wait or read and compress it a second time
+        std::shared_ptr<const CachedFile> load(std::string_view url, const std::filesystem::path& path, ContentType type){
+            auto& shard = shard_of(url);
+            {
+                auto guard = std::unique_lock{shard.lock};
+                if(!shard.loading.emplace(url).second)
+                    return nullptr;
+            }
+            struct Loaded{
+                Shard& shard;
+                std::string_view url;
+                ~Loaded(){ // Also when reading throws
+                    auto guard = std::unique_lock{shard.lock};
+                    shard.loading.erase(shard.loading.find(url));
+                }
+            } loaded{shard, url};
+
+            std::filesystem::file_time_type modified;
+            auto file = read(path, type, modified);
+            if(file == nullptr)
+                return nullptr;
+
+            auto guard = std::unique_lock{shard.lock};
+            if(auto it = shard.entries.find(url); it != shard.entries.end())
+                erase(shard, it);
+            while(shard.used + file->size() > shard_budget && !shard.entries.empty()){
+                auto oldest = std::min_element(shard.entries.begin(), shard.entries.end(), [](const auto& a, const auto& b){
+                    return a.second.last_used.load(std::memory_order_relaxed) < b.second.last_used.load(std::memory_order_relaxed);
+                });
+                erase(shard, oldest);
+            }
+            shard.used += file->size();
+            shard.entries.try_emplace(std::string{url}, file, path, modified, Clock::now().time_since_epoch().count());
+            return file;
+        }
+    };
+}
@@ -0,0 +1,142 @@
+#include "tls.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
+
+namespace htpp{
+    namespace{
+        // ALPN protocols in wire format and in order of preference
+        constexpr unsigned char alpn_protocols[] = "\x08http/1.1\x08http/1.0";
+
+        int select_alpn(SSL*, const unsigned char** out, unsigned char* out_size, const unsigned char* offered, unsigned int offered_size, void*){
+            unsigned char* selected = nullptr;
+            if(SSL_select_next_proto(&selected, out_size, alpn_protocols, sizeof(alpn_protocols) - 1, offered, offered_size) != OPENSSL_NPN_NEGOTIATED)
+                return SSL_TLSEXT_ERR_ALERT_FATAL; // A client asking only for h2 gets no_application_protocol rather than HTTP/1.1 it didn't expect
+            *out = selected;
+            return SSL_TLSEXT_ERR_OK;
+        }
+
+        // Where the ticket callback finds its TlsContext, asio already uses the SSL_CTX app data
+        int context_index(){
+            static int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+            return index;
+        }
+
+        void check(long result, const char* what){
+            if(result != 1)
+                throw std::runtime_error{what};
+        }
+    }
+
+    TlsContext::TlsContext(const SslConfig& config): ticket_rotation{config.ticket_rotation} {
+        auto* handle = context.native_handle();
+        context.use_certificate_chain_file(config.cert_path);
+        context.use_private_key_file(config.private_key, asio::ssl::context_base::pem);
+        context.set_verify_mode(asio::ssl::verify_none);
+
+        check(SSL_CTX_set_min_proto_version(handle, TLS1_2_VERSION), "Can't restrict TLS versions");
+        SSL_CTX_set_options(handle, SSL_OP_NO_RENEGOTIATION | (config.prefer_server_ciphers ? SSL_OP_CIPHER_SERVER_PREFERENCE : 0));
+        if(!config.ciphers.empty())
+            check(SSL_CTX_set_cipher_list(handle, config.ciphers.c_str()), "Invalid TLS 1.2 cipher list");
+        if(!config.ciphersuites.empty())
+            check(SSL_CTX_set_ciphersuites(handle, config.ciphersuites.c_str()), "Invalid TLS 1.3 cipher suites");
+        SSL_CTX_set_alpn_select_cb(handle, select_alpn, nullptr);
+
+        // Session ids resume from the shared cache, tickets resume without any server state
+        constexpr unsigned char session_context[] = "htpp";
+        check(SSL_CTX_set_session_id_context(handle, session_context, sizeof(session_context) - 1), "Can't set TLS session context");
+        SSL_CTX_set_timeout(handle, static_cast<long>(config.session_lifetime.count()));
+        if(config.session_cache_size > 0){
+            SSL_CTX_set_session_cache_mode(handle, SSL_SESS_CACHE_SERVER);
+            SSL_CTX_sess_set_cache_size(handle, static_cast<long>(config.session_cache_size));
+        }else{
+            SSL_CTX_set_session_cache_mode(handle, SSL_SESS_CACHE_OFF);
+        }
+        if(ticket_rotation.count() > 0){
+            keys[0] = generate_key();
+            key_count = 1;
+            SSL_CTX_set_ex_data(handle, context_index(), this);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+            SSL_CTX_set_tlsext_ticket_key_evp_cb(handle, [](SSL* ssl, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cipher, EVP_MAC_CTX* mac, int encrypt){
+                return ticket_callback(ssl, name, iv, cipher, mac, encrypt);
+            });
+#else
+            SSL_CTX_set_tlsext_ticket_key_cb(handle, [](SSL* ssl, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cipher, HMAC_CTX* mac, int encrypt){
+                return ticket_callback(ssl, name, iv, cipher, mac, encrypt);
+            });
+#endif
+        }else{
+            SSL_CTX_set_options(handle, SSL_OP_NO_TICKET);
+        }
+    }
+
+    TlsContext::TicketKey TlsContext::generate_key(){
+        TicketKey key;
+        check(RAND_bytes(key.name.data(), static_cast<int>(key.name.size())), "Can't generate a session ticket key");
+        check(RAND_bytes(key.aes_key.data(), static_cast<int>(key.aes_key.size())), "Can't generate a session ticket key");
+        check(RAND_bytes(key.hmac_key.data(), static_cast<int>(key.hmac_key.size())), "Can't generate a session ticket key");
+        key.created = std::chrono::steady_clock::now();
+        return key;
+    }
+
+    int TlsContext::ticket_callback(SSL* ssl, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cipher, void* mac, int encrypt){
+        auto* self = static_cast<TlsContext*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), context_index()));
+        return self->ticket(name, iv, cipher, mac, encrypt == 1);
+    }
+
+    // Returns what OpenSSL expects: 1 ticket handled, 2 decrypted but reissue it under the current key, 0 unknown key, -1 error
+    int TlsContext::ticket(unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cipher, void* mac, bool encrypt){
+        TicketKey key;
+        bool outdated = false;
+        {
+            auto guard = std::lock_guard{keys_lock};
+            // Rotated lazily by the first handshake after the period, no timer needed
+            auto now = std::chrono::steady_clock::now();
+            if(now - keys[0].created >= ticket_rotation){
+                keys[1] = keys[0];
+                keys[0] = generate_key();
+                key_count = 2;
+            }
+            if(encrypt){
+                key = keys[0];
+            }else{
+                std::size_t index = 0;
+                while(index < key_count && std::memcmp(keys[index].name.data(), name, keys[index].name.size()) != 0)
+                    index++;
+                if(index == key_count || now - keys[index].created >= 2 * ticket_rotation)
+                    return 0; // Expired or from another process, falls back to a full handshake
+                key = keys[index];
+                outdated = index > 0;
+            }
+        }
+
+        if(encrypt){
+            std::memcpy(name, key.name.data(), key.name.size());
+            if(RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1)
+                return -1;
+        }
+        if(EVP_CipherInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key.aes_key.data(), iv, encrypt ? 1 : 0) != 1)
+            return -1;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        char digest[] = "SHA256";
+        OSSL_PARAM params[] = {
+            OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmac_key.data(), key.hmac_key.size()),
+            OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+            OSSL_PARAM_construct_end()
+        };
+        if(EVP_MAC_CTX_set_params(static_cast<EVP_MAC_CTX*>(mac), params) != 1)
+            return -1;
+#else
+        if(HMAC_Init_ex(static_cast<HMAC_CTX*>(mac), key.hmac_key.data(), static_cast<int>(key.hmac_key.size()), EVP_sha256(), nullptr) != 1)
+            return -1;
+#endif
+        return outdated ? 2 : 1;
+    }
+}
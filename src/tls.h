@@ -0,0 +1,64 @@
+#pragma once
+#include <htpp/lib.h>
+#include <asio/ssl.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+namespace htpp{
+    // Server side TLS setup: resumption through the session cache and rotating session tickets, ALPN, cipher preferences
+    class TlsContext{
+        // Session ticket keys, tickets are encrypted with the newest key and the previous one still decrypts
+        struct TicketKey{
+            std::array<unsigned char, 16> name;
+            std::array<unsigned char, 32> aes_key;
+            std::array<unsigned char, 32> hmac_key;
+            std::chrono::steady_clock::time_point created;
+        };
+
+        struct Counters{
+            std::atomic<std::size_t> full{0};
+            std::atomic<std::size_t> resumed{0};
+            std::atomic<std::size_t> failed{0};
+        };
+        static Counters& counters(){
+            static Counters instance;
+            return instance;
+        }
+
+        asio::ssl::context context{asio::ssl::context::tls_server};
+        std::chrono::seconds ticket_rotation;
+        std::mutex keys_lock;
+        std::array<TicketKey, 2> keys; // Current, previous
+        std::size_t key_count{0};
+
+        static TicketKey generate_key();
+        static int ticket_callback(SSL* ssl, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cipher, void* mac, int encrypt);
+        int ticket(unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cipher, void* mac, bool encrypt);
+
+    public:
+        explicit TlsContext(const SslConfig& config);
+        TlsContext(const TlsContext&) = delete;
+        TlsContext& operator=(const TlsContext&) = delete;
+
+        asio::ssl::context& native(){ return context; }
+
+        static void handshake_done(SSL* ssl){
+            (SSL_session_reused(ssl) ? counters().resumed : counters().full).fetch_add(1, std::memory_order_relaxed);
+        }
+
+        static void handshake_failed(){
+            counters().failed.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        static TlsStats stats(){
+            return {
+                counters().full.load(std::memory_order_relaxed),
+                counters().resumed.load(std::memory_order_relaxed),
+                counters().failed.load(std::memory_order_relaxed)
+            };
+        }
+    };
+}